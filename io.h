@@ -3,11 +3,23 @@
 
 #include <stdint.h>
 
+#ifndef SIM
+/// 1 = the host simulator build (sim/arisc-sim)
+#define SIM                 0
+#endif
+
 #define readl(addr)         (*((volatile uint32_t *)(addr)))
 #define writel(v, addr)     (readl(addr) = (uint32_t)(v))
 #define set_bit(nr, addr)   (readl(addr) |=  (1u << (nr)))
 #define clr_bit(nr, addr)   (readl(addr) &= ~(1u << (nr)))
 
+/// wait for all memory accesses to complete
+#if SIM
+#define msync()             __sync_synchronize()
+#else
+#define msync()             __asm__ __volatile__ ("l.msync" ::: "memory")
+#endif
+
 #define BIT(nr)             (1u << (nr))
 #define MASK(nr)            ((1u << (nr)) - 1)
 #define MASK_AT(nr, start)  (MASK(nr) << (start))
@@ -1,21 +1,46 @@
 #include <stdint.h>
 #include <stddef.h>
 
-uint64_t __udivmoddi4(uint64_t num, uint64_t den, uint64_t *rem_p)
+/* Number of leading zero bits, x must be non-zero */
+static inline int clz32(uint32_t x)
+{
+	int n = 0;
+
+	if (!(x & 0xFFFF0000)) { n += 16; x <<= 16; }
+	if (!(x & 0xFF000000)) { n +=  8; x <<=  8; }
+	if (!(x & 0xF0000000)) { n +=  4; x <<=  4; }
+	if (!(x & 0xC0000000)) { n +=  2; x <<=  2; }
+	if (!(x & 0x80000000)) { n +=  1; }
+
+	return n;
+}
+
+static inline int clz64(uint64_t x)
+{
+	return (x >> 32) ? clz32(x >> 32) : 32 + clz32((uint32_t) x);
+}
+
+uint32_t __udivmodsi4(uint32_t num, uint32_t den, uint32_t *rem_p)
 {
-	uint64_t quot = 0, qbit = 1;
+	uint32_t quot = 0, qbit;
+	int shift;
 
 	if (den == 0) {
 		// trigger exception
 		return 0;
 	}
 
-	/* Left-justify denominator and count shift */
-	while ((long long) den >= 0) {
-		den <<= 1;
-		qbit <<= 1;
+	if (den > num) {
+		if (rem_p)
+			*rem_p = num;
+		return 0;
 	}
 
+	/* Align denominator with the numerator, only quotient bits are looped */
+	shift = clz32(den) - clz32(num);
+	den <<= shift;
+	qbit = 1U << shift;
+
 	while (qbit) {
 		if (den <= num) {
 			num -= den;
@@ -31,21 +56,36 @@ uint64_t __udivmoddi4(uint64_t num, uint64_t den, uint64_t *rem_p)
 	return quot;
 }
 
-uint32_t __udivmodsi4(uint32_t num, uint32_t den, uint32_t *rem_p)
+uint64_t __udivmoddi4(uint64_t num, uint64_t den, uint64_t *rem_p)
 {
-	uint32_t quot = 0, qbit = 1;
+	uint64_t quot = 0, qbit;
+	uint32_t rem32;
+	int shift;
 
 	if (den == 0) {
 		// trigger exception
 		return 0;
 	}
 
-	/* Left-justify denominator and count shift */
-	while ((int) den >= 0) {
-		den <<= 1;
-		qbit <<= 1;
+	if (den > num) {
+		if (rem_p)
+			*rem_p = num;
+		return 0;
+	}
+
+	/* 32-bit operands are much cheaper to divide */
+	if (!(num >> 32)) {
+		quot = __udivmodsi4((uint32_t) num, (uint32_t) den, &rem32);
+		if (rem_p)
+			*rem_p = rem32;
+		return quot;
 	}
 
+	/* Align denominator with the numerator, only quotient bits are looped */
+	shift = clz64(den) - clz64(num);
+	den <<= shift;
+	qbit = 1ULL << shift;
+
 	while (qbit) {
 		if (den <= num) {
 			num -= den;
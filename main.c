@@ -16,10 +16,29 @@
  */
 
 #include "sys.h"
+#include "mod_timer.h"
 #include "mod_gpio.h"
 #include "mod_msg.h"
+#include "mod_sched.h"
 #include "mod_stepgen.h"
+#include "mod_pulsgen.h"
+#include "mod_pwm.h"
+#include "mod_wave.h"
 #include "mod_encoder.h"
+#include "mod_capture.h"
+#include "mod_status.h"
+#include "mod_conf.h"
+#include "mod_perf.h"
+
+
+
+
+#if STEPGEN_CH_CNT >= SCHED_WATCHDOG_CH || PULSGEN_CH_CNT >= SCHED_WATCHDOG_CH
+#error "too many channels for the scheduler ids"
+#endif
+#if SCHED_SIZE < (STEPGEN_CH_CNT + 1 + PULSGEN_MODULE * (PULSGEN_CH_CNT + 1) + WAVE_MODULE)
+#error "SCHED_SIZE is too small for all stepgen, pulsgen and wave channels"
+#endif
 
 
 
@@ -31,17 +50,62 @@ int main(void)
     clk_set_rate(CPU_FREQ);
 
     // modules init
+#if PERF
+    perf_module_init();
+#endif
     msg_module_init();
     gpio_module_init();
     stepgen_module_init();
+#if PULSGEN_MODULE
+    pulsgen_module_init();
+#endif
+#if PWM_MODULE
+    pwm_module_init();
+#endif
+#if WAVE_MODULE
+    wave_module_init();
+#endif
+#if ENCODER_MODULE
     encoder_module_init();
+#endif
+#if CAPTURE_MODULE
+    capture_module_init();
+#endif
+#if STATUS_MODULE
+    status_module_init();
+#endif
+    sched_module_init();
+#if CONF_MODULE
+    // pins and channels of the table, positions of the warm restart
+    conf_module_init();
+#endif
 
     // main loop
     for(;;)
     {
-        msg_module_base_thread();
-        encoder_module_base_thread();
-        stepgen_module_base_thread();
+        PERF_LOOP();
+        PERF_CALL(PERF_THREAD_MSG, msg_module_base_thread());
+#if ENCODER_MODULE
+        PERF_CALL(PERF_THREAD_ENCODER, encoder_module_base_thread());
+#endif
+#if STEPGEN_LOOP
+        PERF_CALL(PERF_THREAD_STEPGEN, stepgen_module_base_thread());
+#endif
+#if CAPTURE_MODULE
+        PERF_CALL(PERF_THREAD_CAPTURE, capture_module_base_thread());
+#endif
+#if !TIMER_IRQ_MODE
+        PERF_CALL(PERF_THREAD_SCHED, sched_module_base_thread());
+#endif
+#if WAVE_MODULE
+        PERF_CALL(PERF_THREAD_WAVE, wave_module_base_thread());
+#endif
+#if STATUS_MODULE
+        PERF_CALL(PERF_THREAD_STATUS, status_module_base_thread());
+#endif
+#if CONF_MODULE
+        PERF_CALL(PERF_THREAD_CONF, conf_module_base_thread());
+#endif
     }
 
     return 0;
@@ -0,0 +1,344 @@
+/**
+ * @file    mod_capture.c
+ *
+ * @brief   input capture module
+ *
+ * This module implements an API to latch the timestamp
+ * and all channels positions on the probe and limit input edges
+ */
+
+#include "mod_timer.h"
+#include "mod_gpio.h"
+#include "mod_stepgen.h"
+#include "mod_encoder.h"
+#include "mod_capture.h"
+
+
+
+
+// private vars
+
+static struct capture_ch_t cap[CAPTURE_CH_CNT] = {{0}}; // array of channels data
+static uint8_t armed_cnt = 0; // number of armed channels
+static uint8_t send_cnt = 0; // number of records to send
+
+// uses with GPIO module macros
+extern volatile uint32_t * gpio_port_data[GPIO_PORTS_CNT];
+
+#define CAPTURE_SENT 0xFF
+
+
+
+
+// private functions
+
+static void latch(uint8_t c, uint8_t edge)
+{
+    uint8_t v;
+
+    // positions must not be changed by the channels processing
+    TIMER_IRQ_LOCK();
+
+    cap[c].tick = timer_cnt_get_64();
+
+    for ( v = 0; v < STEPGEN_CH_CNT; v++ ) cap[c].values[v] = stepgen_pos_get(v);
+#if ENCODER_MODULE
+    for ( v = 0; v < ENCODER_CH_CNT; v++ ) cap[c].values[STEPGEN_CH_CNT + v] = encoder_counts_get(v);
+#endif
+
+    // stop the axes before their next step, the probe stop mustn't ramp down
+    // past the trigger point, so never use STEPGEN_ABORT_DECEL here
+    for ( v = 0; v < STEPGEN_CH_CNT && v < 32; v++ )
+    {
+        if ( cap[c].abort_mask & (1UL << v) ) stepgen_abort(v, STEPGEN_ABORT_ALL);
+    }
+
+    TIMER_IRQ_UNLOCK();
+
+    // one record per arm
+    cap[c].armed = 0;
+    --armed_cnt;
+
+    cap[c].edge = edge;
+    ++cap[c].events;
+    if ( cap[c].send_pos == CAPTURE_SENT ) ++send_cnt;
+    cap[c].send_pos = 0;
+}
+
+/// send the channel record to the ARM, message 0 is the event, next messages are values
+static void send(uint8_t c)
+{
+    u32_10_t *out;
+    uint8_t v, first;
+
+    for(;;)
+    {
+        // no free slot? - try again at the next pass, nothing is lost yet
+        if ( !msg_slot_free() ) return;
+
+        if ( !cap[c].send_pos )
+        {
+            out = (u32_10_t*) msg_reserve();
+            out->v[0] = c;
+            out->v[1] = cap[c].edge;
+            out->v[2] = cap[c].events;
+            out->v[3] = (uint32_t) cap[c].tick;
+            out->v[4] = (uint32_t) (cap[c].tick >> 32);
+            out->v[5] = CAPTURE_VALUES_CNT;
+            if ( msg_commit(CAPTURE_MSG_EVENT, 6*4) ) return;
+        }
+        else
+        {
+            first = (cap[c].send_pos - 1) * CAPTURE_MSG_VALUES_CNT;
+
+            // all values sent?
+            if ( first >= CAPTURE_VALUES_CNT )
+            {
+                cap[c].send_pos = CAPTURE_SENT;
+                --send_cnt;
+                return;
+            }
+
+            out = (u32_10_t*) msg_reserve();
+            out->v[0] = c;
+            out->v[1] = cap[c].events;
+            out->v[2] = first;
+            for ( v = 0; v < CAPTURE_MSG_VALUES_CNT; v++ )
+            {
+                out->v[3+v] = first + v < CAPTURE_VALUES_CNT ? (uint32_t) cap[c].values[first + v] : 0;
+            }
+            if ( msg_commit(CAPTURE_MSG_EVENT_VALUES, (3 + CAPTURE_MSG_VALUES_CNT)*4) ) return;
+        }
+
+        ++cap[c].send_pos;
+    }
+}
+
+
+
+
+// public methods
+
+/**
+ * @brief   module init
+ * @note    call this function only once before capture_module_base_thread()
+ * @retval  none
+ */
+void capture_module_init()
+{
+    uint8_t i = 0;
+
+    // add message handlers
+    for ( i = CAPTURE_MSG_SETUP; i < CAPTURE_MSG_CNT; i++ )
+    {
+        msg_recv_callback_add(i, (msg_recv_func_t) capture_msg_recv);
+    }
+
+    for ( i = CAPTURE_CH_CNT; i--; ) cap[i].send_pos = CAPTURE_SENT;
+}
+
+/**
+ * @brief   module base thread
+ * @note    call this function in the main loop, next to the channels processing
+ * @retval  none
+ */
+SYS_HOT void capture_module_base_thread()
+{
+    static uint8_t c, state;
+
+    // nothing to do?
+    if ( !armed_cnt && !send_cnt ) return;
+
+    for ( c = CAPTURE_CH_CNT; c--; )
+    {
+        if ( cap[c].armed )
+        {
+            state = GPIO_PIN_GET(cap[c].port, cap[c].pin_mask) ? 1 : 0;
+
+            if ( state != cap[c].state )
+            {
+                cap[c].state = state;
+                if ( cap[c].edges & (state ? CAPTURE_EDGE_RISING : CAPTURE_EDGE_FALLING) )
+                {
+                    latch(c, state ? CAPTURE_EDGE_RISING : CAPTURE_EDGE_FALLING);
+                }
+            }
+        }
+
+        if ( cap[c].send_pos != CAPTURE_SENT ) send(c);
+    }
+}
+
+
+
+
+/**
+ * @brief   setup the input pin of the selected channel and arm it
+ *
+ * @param   c           channel id
+ * @param   port        GPIO port number
+ * @param   pin         GPIO pin number
+ * @param   edges       CAPTURE_EDGE_RISING, CAPTURE_EDGE_FALLING or CAPTURE_EDGE_BOTH
+ * @param   abort_mask  bit N = abort all tasks of the stepgen channel N on the edge
+ *
+ * @retval  none
+ */
+void capture_setup(uint8_t c, uint8_t port, uint8_t pin, uint8_t edges, uint32_t abort_mask)
+{
+    if ( c >= CAPTURE_CH_CNT || port >= GPIO_PORTS_CNT ) return;
+
+    gpio_pin_setup_for_input(port, pin);
+
+    cap[c].port = port;
+    cap[c].pin_mask = 1U << pin;
+    cap[c].edges = edges & CAPTURE_EDGE_BOTH;
+    cap[c].abort_mask = abort_mask;
+
+    capture_arm(c, 1);
+}
+
+/**
+ * @brief   enable/disable the edges capture of the selected channel
+ *
+ * @param   c       channel id
+ * @param   armed   0 = ignore edges, !0 = latch the next edge
+ *
+ * @note    only the first edge is latched, arm the channel again to latch the next one
+ *
+ * @retval  none
+ */
+void capture_arm(uint8_t c, uint8_t armed)
+{
+    if ( c >= CAPTURE_CH_CNT || !cap[c].pin_mask ) return;
+
+    armed = armed ? 1 : 0;
+    if ( cap[c].armed == armed ) return;
+
+    // edges are counted from the current state
+    cap[c].state = GPIO_PIN_GET(cap[c].port, cap[c].pin_mask) ? 1 : 0;
+
+    cap[c].armed = armed;
+    if ( armed ) ++armed_cnt;
+    else --armed_cnt;
+}
+
+
+
+
+/**
+ * @brief   get the channel state
+ * @param   c   channel id
+ * @retval  0 (channel disarmed)
+ * @retval  1 (channel armed)
+ */
+uint8_t capture_state_get(uint8_t c)
+{
+    return c < CAPTURE_CH_CNT ? cap[c].armed : 0;
+}
+
+/**
+ * @brief   get the number of latched edges
+ * @param   c   channel id
+ * @retval  0..UINT32_MAX
+ */
+uint32_t capture_events_get(uint8_t c)
+{
+    return c < CAPTURE_CH_CNT ? cap[c].events : 0;
+}
+
+/**
+ * @brief   get the latched value of the last channel record
+ *
+ * @param   c       channel id
+ * @param   v       value id, 0..STEPGEN_CH_CNT-1 = stepgen positions, then encoder counts
+ * @param   tick    pointer to the record timestamp or 0
+ *
+ * @retval  latched value
+ */
+int32_t capture_value_get(uint8_t c, uint8_t v, uint64_t * tick)
+{
+    if ( c >= CAPTURE_CH_CNT || v >= CAPTURE_VALUES_CNT ) return 0;
+    if ( tick ) *tick = cap[c].tick;
+    return cap[c].values[v];
+}
+
+
+
+
+/**
+ * @brief   "message received" callback
+ *
+ * @note    this function will be called automatically
+ *          when a new message will arrive for this module.
+ *
+ * @param   type    user defined message type (0..0xFF)
+ * @param   msg     pointer to the message buffer
+ * @param   length  the length of a message (0 .. MSG_LEN)
+ *
+ * @retval   0 (message read)
+ * @retval  -1 (message not read)
+ */
+int8_t volatile capture_msg_recv(uint8_t type, uint8_t * msg, uint8_t length)
+{
+    u32_10_t *in = (u32_10_t*) msg;
+    u32_10_t *out;
+
+    switch (type)
+    {
+        case CAPTURE_MSG_SETUP:
+        {
+            struct capture_msg_setup_t *s = (struct capture_msg_setup_t *) msg;
+            capture_setup(s->ch, s->port, s->pin, s->edges, s->abort_mask);
+            break;
+        }
+        case CAPTURE_MSG_ARM:
+            capture_arm(in->v[0], in->v[1]);
+            break;
+        case CAPTURE_MSG_STATE_GET:
+            out = (u32_10_t*) msg_reserve();
+            out->v[0] = capture_state_get(in->v[0]);
+            out->v[1] = capture_events_get(in->v[0]);
+            msg_commit(type, 2*4);
+            break;
+
+        default: return -1;
+    }
+
+    return 0;
+}
+
+
+
+
+/**
+    @example mod_capture.c
+
+    <b>Usage example 1</b>: probe input on the PA10 pin, stops the X, Y and Z axes
+
+    @code
+        #include <stdint.h>
+        #include "mod_stepgen.h"
+        #include "mod_capture.h"
+
+        int main(void)
+        {
+            // modules init
+            stepgen_module_init();
+            capture_module_init();
+
+            // the probe tip closes the PA10 input to the ground,
+            // the stepgen channels 0, 1 and 2 are aborted at the same pass
+            capture_setup(0, PA, 10, CAPTURE_EDGE_FALLING, 0x7);
+
+            // main loop
+            for(;;)
+            {
+                // the latched record is sent to the ARM
+                // with one CAPTURE_MSG_EVENT and a few CAPTURE_MSG_EVENT_VALUES messages
+                capture_module_base_thread();
+            }
+
+            return 0;
+        }
+    @endcode
+*/
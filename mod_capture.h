@@ -0,0 +1,107 @@
+/**
+ * @file    mod_capture.h
+ *
+ * @brief   input capture module header
+ *
+ * This module implements an API to latch the timestamp
+ * and all channels positions on the probe and limit input edges
+ */
+
+#ifndef _MOD_CAPTURE_H
+#define _MOD_CAPTURE_H
+
+#include <stdint.h>
+#include "mod_msg.h"
+#include "mod_stepgen.h"
+#include "mod_encoder.h"
+
+
+
+
+#ifndef CAPTURE_MODULE
+#define CAPTURE_MODULE      1   ///< 0 = the module isn't used by the firmware
+#endif
+#ifndef CAPTURE_CH_CNT
+#define CAPTURE_CH_CNT      4   ///< maximum number of capture inputs
+#endif
+
+/// number of latched values, all stepgen positions then all encoder counts
+#define CAPTURE_VALUES_CNT  (STEPGEN_CH_CNT + ENCODER_MODULE * ENCODER_CH_CNT)
+/// number of latched values in the CAPTURE_MSG_EVENT_VALUES
+#define CAPTURE_MSG_VALUES_CNT 7
+
+/// capture edges
+enum
+{
+    CAPTURE_EDGE_RISING = 1,
+    CAPTURE_EDGE_FALLING = 2,
+    CAPTURE_EDGE_BOTH = 3
+};
+
+
+
+
+/// a channel state
+struct capture_ch_t
+{
+    uint8_t     armed;              // 0 = edges are ignored
+    uint8_t     edges;              // CAPTURE_EDGE_RISING | CAPTURE_EDGE_FALLING
+    uint8_t     state;              // last input state
+    uint8_t     port;
+    uint32_t    pin_mask;
+    uint32_t    abort_mask;         // bit N = abort the stepgen channel N on the edge
+
+    uint32_t    events;             // number of latched edges
+    uint8_t     edge;               // edge of the latched record
+    uint64_t    tick;               // timestamp of the latched record
+    int32_t     values[CAPTURE_VALUES_CNT];
+    uint8_t     send_pos;           // next value to send, 0xFF = record sent
+};
+
+/// messages types
+enum
+{
+    CAPTURE_MSG_SETUP = 0x80,
+    CAPTURE_MSG_ARM,
+    CAPTURE_MSG_STATE_GET,
+    CAPTURE_MSG_EVENT,
+    CAPTURE_MSG_EVENT_VALUES,
+    CAPTURE_MSG_CNT
+};
+
+/// the message data access
+struct capture_msg_setup_t { uint32_t ch; uint32_t port; uint32_t pin; uint32_t edges; uint32_t abort_mask; };
+struct capture_msg_event_t
+{
+    uint32_t ch; uint32_t edge; uint32_t events;
+    uint32_t tick_lo; uint32_t tick_hi; // edge timestamp
+    uint32_t values_cnt; // number of latched values in the next CAPTURE_MSG_EVENT_VALUES
+};
+struct capture_msg_event_values_t
+{
+    uint32_t ch; uint32_t events;
+    uint32_t first; // index of the values[0]
+    int32_t values[CAPTURE_MSG_VALUES_CNT];
+};
+
+
+
+
+// export public methods
+
+void capture_module_init();
+void capture_module_base_thread();
+
+void capture_setup(uint8_t c, uint8_t port, uint8_t pin, uint8_t edges, uint32_t abort_mask);
+void capture_arm(uint8_t c, uint8_t armed);
+
+uint8_t capture_state_get(uint8_t c);
+uint32_t capture_events_get(uint8_t c);
+int32_t capture_value_get(uint8_t c, uint8_t v, uint64_t * tick);
+
+int8_t volatile capture_msg_recv(uint8_t type, uint8_t * msg, uint8_t length);
+
+
+
+
+#endif
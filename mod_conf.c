@@ -0,0 +1,355 @@
+/**
+ * @file    mod_conf.c
+ *
+ * @brief   boot configuration and warm restart module
+ *
+ * This module setups pins and channels from the configuration table
+ * written by the ARM to the shared memory, and keeps channels positions
+ * across the exception reset
+ */
+
+#include "mod_timer.h"
+#include "mod_gpio.h"
+#include "mod_stepgen.h"
+#include "mod_pulsgen.h"
+#include "mod_encoder.h"
+#include "mod_conf.h"
+
+
+
+
+// private vars
+
+static volatile struct conf_header_t * hdr = (struct conf_header_t *) CONF_ADDR;
+static volatile struct conf_item_t * items = (struct conf_item_t *) (CONF_ADDR + sizeof(struct conf_header_t));
+
+static uint8_t table_state = CONF_TABLE_NONE;
+static uint8_t table_applied = 0; // number of applied items
+
+static volatile uint32_t * canary = (uint32_t *) CONF_CANARY_ADDR;
+
+static struct conf_warm_t warm SYS_NOINIT;
+
+// the table must leave the stack budget in the ARISC_CONF_ADDR area
+typedef char conf_size_check[(CONF_ADDR + CONF_SIZE <= ARISC_CONF_ADDR + ARISC_CONF_SIZE &&
+                              CONF_STACK_SIZE >= CONF_STACK_MIN) ? 1 : -1];
+
+
+
+
+// private functions
+
+/// the table checksum, sum of `cnt` and all items words
+static uint32_t table_sum(uint32_t cnt)
+{
+    volatile uint32_t *w = (volatile uint32_t *) items;
+    uint32_t i, sum = cnt;
+
+    for ( i = cnt * sizeof(struct conf_item_t) / 4; i--; ) sum += w[i];
+
+    return sum;
+}
+
+/// setup an item, returns -1 if the item isn't valid
+static int8_t item_apply(volatile struct conf_item_t * t)
+{
+    uint8_t c = t->ch, port = t->port, pin = t->pin;
+
+    if ( port >= GPIO_PORTS_CNT || pin >= 32 ) return -1;
+
+    switch (t->type)
+    {
+        case CONF_ITEM_GPIO_OUTPUT:
+            gpio_pin_setup_for_output(port, pin);
+            if ( t->v0 ) gpio_pin_set(port, pin);
+            else gpio_pin_clear(port, pin);
+            break;
+        case CONF_ITEM_GPIO_INPUT:
+            gpio_pin_setup_for_input(port, pin);
+            break;
+
+        case CONF_ITEM_STEPGEN_PIN:
+            if ( c >= STEPGEN_CH_CNT || t->v0 > 1 ) return -1;
+            stepgen_pin_setup(c, t->v0, port, pin, t->v1);
+            break;
+        case CONF_ITEM_STEPGEN_DIR_TIMING:
+            if ( stepgen_dir_timing_setup(c, t->v0, t->v1) ) return -1;
+            break;
+        case CONF_ITEM_STEPGEN_DECEL:
+            if ( stepgen_decel_setup(c, t->v0) ) return -1;
+            break;
+
+#if PULSGEN_MODULE
+        case CONF_ITEM_PULSGEN_PIN:
+            if ( c >= PULSGEN_CH_CNT ) return -1;
+            pulsgen_pin_setup(c, port, pin, t->v0);
+            break;
+#endif
+
+#if ENCODER_MODULE
+        case CONF_ITEM_ENCODER_PIN:
+            if ( c >= ENCODER_CH_CNT || t->v0 > PHASE_Z ) return -1;
+            encoder_pin_setup(c, t->v0, port, pin);
+            break;
+        case CONF_ITEM_ENCODER_SETUP:
+            if ( c >= ENCODER_CH_CNT ) return -1;
+            encoder_setup(c, t->v0 ? 1 : 0, t->v1 ? 1 : 0);
+            encoder_state_set(c, 1);
+            break;
+#endif
+
+        default: return -1;
+    }
+
+    return 0;
+}
+
+/// restore positions saved by conf_warm_save()
+static void warm_restore()
+{
+    uint8_t c;
+
+    // cold boot? - the noinit data is random
+    if ( warm.magic != CONF_WARM_MAGIC && warm.magic != CONF_COLD_MAGIC )
+    {
+        warm.restarts = 0;
+        warm.type = 0;
+        warm.pc = 0;
+    }
+
+    if ( warm.magic == CONF_WARM_MAGIC )
+    {
+        for ( c = STEPGEN_CH_CNT; c--; ) stepgen_pos_set(c, warm.stepgen_pos[c]);
+#if ENCODER_MODULE
+        for ( c = ENCODER_CH_CNT; c--; ) encoder_counts_set(c, warm.encoder_counts[c]);
+#endif
+    }
+
+    // positions are restored once
+    warm.magic = CONF_COLD_MAGIC;
+}
+
+
+
+
+// public methods
+
+/**
+ * @brief   module init, applies the table and restores the saved positions
+ * @note    call this function only once, after all other modules init
+ * @retval  none
+ */
+void conf_module_init()
+{
+    uint8_t i = 0;
+
+    for ( i = CONF_CANARY_CNT; i--; ) canary[i] = CONF_CANARY;
+
+    conf_apply(0);
+    warm_restore();
+
+    // add message handlers
+    for ( i = CONF_MSG_APPLY; i < CONF_MSG_CNT; i++ )
+    {
+        msg_recv_callback_add(i, (msg_recv_func_t) conf_msg_recv);
+    }
+}
+
+/**
+ * @brief   module base thread, checks the stack canary
+ * @note    call this function anywhere in the main loop
+ * @retval  none
+ */
+SYS_HOT void conf_module_base_thread()
+{
+    uint8_t i;
+
+    for ( i = CONF_CANARY_CNT; i--; )
+    {
+        // the stack reached the table? - restart with the current positions
+        if ( canary[i] != CONF_CANARY )
+        {
+            conf_warm_save(CONF_EXC_STACK, 0);
+            reset();
+        }
+    }
+}
+
+
+
+
+/**
+ * @brief   setup pins and channels from the table at CONF_ADDR
+ *
+ * @note    items are applied in the table order,
+ *          the first invalid item stops the processing
+ *
+ * @param   applied     pointer to the number of applied items or 0
+ *
+ * @retval  CONF_TABLE_NONE (no valid table)
+ * @retval  CONF_TABLE_DONE (all items applied)
+ * @retval  CONF_TABLE_ERROR (invalid item)
+ */
+uint8_t conf_apply(uint8_t * applied)
+{
+    uint32_t cnt = hdr->cnt;
+    uint8_t i;
+
+    table_applied = 0;
+    table_state = CONF_TABLE_NONE;
+
+    // no table? OR the table is damaged?
+    if ( hdr->magic != CONF_MAGIC || cnt > CONF_ITEMS_CNT || hdr->sum != table_sum(cnt) )
+    {
+        if ( applied ) *applied = 0;
+        return table_state;
+    }
+
+    table_state = CONF_TABLE_DONE;
+
+    for ( i = 0; i < cnt && items[i].type != CONF_ITEM_END; i++ )
+    {
+        if ( item_apply(&items[i]) ) { table_state = CONF_TABLE_ERROR; break; }
+        ++table_applied;
+    }
+
+#if STEPGEN_GPIO_BATCH
+    gpio_port_flush();
+#endif
+
+    if ( applied ) *applied = table_applied;
+    return table_state;
+}
+
+
+
+
+/**
+ * @brief   save channels positions before the exception reset
+ *
+ * @note    the next conf_module_init() restores them
+ *
+ * @param   type    exception type
+ * @param   pc      exception address
+ *
+ * @retval  none
+ */
+void conf_warm_save(uint32_t type, uint32_t pc)
+{
+    uint8_t c;
+
+    for ( c = STEPGEN_CH_CNT; c--; ) warm.stepgen_pos[c] = stepgen_pos_get(c);
+#if ENCODER_MODULE
+    for ( c = ENCODER_CH_CNT; c--; ) warm.encoder_counts[c] = encoder_counts_get(c);
+#endif
+
+    if ( warm.magic != CONF_COLD_MAGIC && warm.magic != CONF_WARM_MAGIC ) warm.restarts = 0;
+    ++warm.restarts;
+    warm.type = type;
+    warm.pc = pc;
+    warm.magic = CONF_WARM_MAGIC;
+}
+
+/**
+ * @brief   get the module state
+ *
+ * @param   applied     pointer to the number of applied table items or 0
+ * @param   restarts    pointer to the number of warm restarts or 0
+ * @param   type        pointer to the last warm restart exception type or 0
+ * @param   pc          pointer to the last warm restart exception address or 0
+ *
+ * @retval  CONF_TABLE_NONE, CONF_TABLE_DONE or CONF_TABLE_ERROR
+ */
+uint8_t conf_state_get(uint8_t * applied, uint32_t * restarts, uint32_t * type, uint32_t * pc)
+{
+    if ( applied ) *applied = table_applied;
+    if ( restarts ) *restarts = warm.restarts;
+    if ( type ) *type = warm.type;
+    if ( pc ) *pc = warm.pc;
+    return table_state;
+}
+
+
+
+
+/**
+ * @brief   "message received" callback
+ *
+ * @note    this function will be called automatically
+ *          when a new message will arrive for this module.
+ *
+ * @param   type    user defined message type (0..0xFF)
+ * @param   msg     pointer to the message buffer
+ * @param   length  the length of a message (0 .. MSG_LEN)
+ *
+ * @retval   0 (message read)
+ * @retval  -1 (message not read)
+ */
+int8_t volatile conf_msg_recv(uint8_t type, uint8_t * msg, uint8_t length)
+{
+    u32_10_t *out;
+    uint8_t applied = 0;
+
+    switch (type)
+    {
+        case CONF_MSG_APPLY:
+        {
+            uint8_t state = conf_apply(&applied);
+            out = (u32_10_t*) msg_reserve();
+            out->v[0] = state;
+            out->v[1] = applied;
+            msg_commit(type, 2*4);
+            break;
+        }
+        case CONF_MSG_STATE_GET:
+            out = (u32_10_t*) msg_reserve();
+            out->v[0] = conf_state_get(&applied, &out->v[2], &out->v[3], &out->v[4]);
+            out->v[1] = applied;
+            msg_commit(type, 5*4);
+            break;
+
+        default: return -1;
+    }
+
+    return 0;
+}
+
+
+
+
+/**
+    @example mod_conf.c
+
+    <b>Usage example 1</b>: the ARM side table of one axis with an encoder
+
+    @code
+        #include <stdint.h>
+        #include "mod_conf.h"
+
+        void table_write(void)
+        {
+            struct conf_header_t *hdr = (struct conf_header_t *) CONF_ADDR;
+            struct conf_item_t *items = (struct conf_item_t *) (CONF_ADDR + sizeof(struct conf_header_t));
+            uint32_t *w = (uint32_t *) items;
+            uint32_t i, cnt = 0, sum;
+
+            // STEP on PA3, DIR on PA6, 2 us DIR setup and hold times
+            items[cnt++] = (struct conf_item_t) { CONF_ITEM_STEPGEN_PIN, 0, PA, 3, 0, 0 };
+            items[cnt++] = (struct conf_item_t) { CONF_ITEM_STEPGEN_PIN, 0, PA, 6, 1, 0 };
+            items[cnt++] = (struct conf_item_t) { CONF_ITEM_STEPGEN_DIR_TIMING, 0, 0, 0, 2000, 2000 };
+
+            // A/B encoder on PA10 and PA11
+            items[cnt++] = (struct conf_item_t) { CONF_ITEM_ENCODER_PIN, 0, PA, 10, PHASE_A, 0 };
+            items[cnt++] = (struct conf_item_t) { CONF_ITEM_ENCODER_PIN, 0, PA, 11, PHASE_B, 0 };
+            items[cnt++] = (struct conf_item_t) { CONF_ITEM_ENCODER_SETUP, 0, 0, 0, 1, 0 };
+
+            for ( sum = cnt, i = cnt * sizeof(struct conf_item_t) / 4; i--; ) sum += w[i];
+
+            // the magic is the last, the firmware reads the table at the start
+            // or by the CONF_MSG_APPLY message
+            hdr->cnt = cnt;
+            hdr->sum = sum;
+            hdr->magic = CONF_MAGIC;
+        }
+    @endcode
+*/
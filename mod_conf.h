@@ -0,0 +1,133 @@
+/**
+ * @file    mod_conf.h
+ *
+ * @brief   boot configuration and warm restart module header
+ *
+ * This module setups pins and channels from the configuration table
+ * written by the ARM to the shared memory, and keeps channels positions
+ * across the exception reset
+ */
+
+#ifndef _MOD_CONF_H
+#define _MOD_CONF_H
+
+#include <stdint.h>
+#include "mod_msg.h"
+#include "mod_stepgen.h"
+#include "mod_pulsgen.h"
+#include "mod_encoder.h"
+#include "mod_status.h"
+
+
+
+
+#ifndef CONF_MODULE
+#define CONF_MODULE             1 ///< 0 = the module isn't used by the firmware
+#endif
+
+/// the table address, right after the status snapshot
+#define CONF_ADDR               (STATUS_ADDR + STATUS_SIZE)
+#define CONF_SIZE               384 ///< table area size
+
+/*
+ * the stack budget: the stack grows down from the end of the ARISC_CONF_ADDR area
+ * (0xBFFC, see start.S) to the canary words right after the table,
+ * so it has 2048 - 128 (rings) - 512 (status) - 384 (table) - 16 (canary) = 1008 bytes,
+ * one exception frame takes 256 bytes of them
+ */
+#define CONF_CANARY_ADDR        (CONF_ADDR + CONF_SIZE) ///< the lowest stack words
+#define CONF_CANARY_CNT         4
+#define CONF_CANARY             0x4B415453 ///< "STAK"
+#define CONF_STACK_SIZE         (ARISC_CONF_ADDR + ARISC_CONF_SIZE - CONF_CANARY_ADDR - CONF_CANARY_CNT * 4)
+#define CONF_STACK_MIN          768 ///< the main loop chain plus one exception frame
+
+#define CONF_EXC_STACK          0xFF ///< conf_warm_save() type of the stack overflow
+
+#define CONF_MAGIC              0x464E4341 ///< "ACNF", the table is valid
+#define CONF_WARM_MAGIC         0x4D524157 ///< "WARM", positions are saved by the exception
+#define CONF_COLD_MAGIC         0x444C4F43 ///< "COLD", positions are already restored
+
+/// maximum number of the table items
+#define CONF_ITEMS_CNT          ((CONF_SIZE - sizeof(struct conf_header_t)) / sizeof(struct conf_item_t))
+
+/// table items types
+enum
+{
+    CONF_ITEM_END,              // end of the table
+    CONF_ITEM_GPIO_OUTPUT,      // port, pin, v0 = pin state
+    CONF_ITEM_GPIO_INPUT,       // port, pin
+    CONF_ITEM_STEPGEN_PIN,      // ch, port, pin, v0 = 0:step 1:dir, v1 = invert
+    CONF_ITEM_STEPGEN_DIR_TIMING, // ch, v0 = setup time, v1 = hold time (in nanoseconds)
+    CONF_ITEM_STEPGEN_DECEL,    // ch, v0 = deceleration (in steps/s^2)
+    CONF_ITEM_PULSGEN_PIN,      // ch, port, pin, v0 = invert
+    CONF_ITEM_ENCODER_PIN,      // ch, port, pin, v0 = PHASE_A, PHASE_B or PHASE_Z
+    CONF_ITEM_ENCODER_SETUP,    // ch, v0 = using B, v1 = using Z, the channel is enabled
+    CONF_ITEM_CNT
+};
+
+/// table states
+enum
+{
+    CONF_TABLE_NONE,            // no valid table
+    CONF_TABLE_DONE,            // all items are applied
+    CONF_TABLE_ERROR            // an item isn't valid, items before it are applied
+};
+
+
+
+
+/// the table header
+struct conf_header_t
+{
+    uint32_t    magic; // CONF_MAGIC
+    uint32_t    cnt; // number of items
+    uint32_t    sum; // sum of `cnt` and all items words
+    uint32_t    reserved;
+};
+
+/// the table item
+struct conf_item_t
+{
+    uint8_t     type;
+    uint8_t     ch;
+    uint8_t     port;
+    uint8_t     pin;
+    uint32_t    v0;
+    uint32_t    v1;
+};
+
+/// positions saved by the exception, the bss clear at the start doesn't touch them
+struct conf_warm_t
+{
+    uint32_t    magic; // CONF_WARM_MAGIC or CONF_COLD_MAGIC
+    uint32_t    restarts; // number of the warm restarts since the cold boot
+    uint32_t    type; // exception type of the last warm restart
+    uint32_t    pc; // exception address of the last warm restart
+    int32_t     stepgen_pos[STEPGEN_CH_CNT];
+    int32_t     encoder_counts[ENCODER_CH_CNT];
+};
+
+/// messages types
+enum
+{
+    CONF_MSG_APPLY = 0x90,
+    CONF_MSG_STATE_GET,
+    CONF_MSG_CNT
+};
+
+
+
+
+// export public methods
+
+void conf_module_init();
+void conf_module_base_thread();
+uint8_t conf_apply(uint8_t * applied);
+void conf_warm_save(uint32_t type, uint32_t pc);
+uint8_t conf_state_get(uint8_t * applied, uint32_t * restarts, uint32_t * type, uint32_t * pc);
+int8_t volatile conf_msg_recv(uint8_t type, uint8_t * msg, uint8_t length);
+
+
+
+
+#endif
@@ -7,6 +7,7 @@
  * to make real-time counting of quadrature encoder pulses
  */
 
+#include "mod_timer.h"
 #include "mod_gpio.h"
 #include "mod_encoder.h"
 
@@ -15,11 +16,9 @@
 
 // private vars
 
-static struct encoder_ch_t enc[ENCODER_CH_CNT] = {0}; // array of channels data
+static struct encoder_ch_t enc[ENCODER_CH_CNT] SYS_HOT_BSS = {0}; // array of channels data
 
-static uint8_t msg_buf[ENCODER_MSG_BUF_LEN] = {0};
-
-static uint8_t state_list[4] =
+static int8_t AB_transition[16] =
 {
     //      clockwise (CW) direction phase states sequence
 
@@ -30,20 +29,66 @@ static uint8_t state_list[4] =
 
     // B    __|`````|_____|`````|_____|`````|_____
 
-    //        AB    AB    AB    AB
-    //      0b00, 0b01, 0b11, 0b10
+    // counts change for the (prev AB << 2 | next AB) index,
+    // 0 for no change and for the invalid (both phases changed) transition
 
-    // prev    next
-    //   AB      AB
-    /* 0b00 */ 0b01,
-    /* 0b01 */ 0b11,
-    /* 0b10 */ 0b00,
-    /* 0b11 */ 0b10
+    //  next AB:    0b00  0b01  0b10  0b11
+    /* 0b00 */         0,   +1,   -1,    0,
+    /* 0b01 */        -1,    0,    0,   +1,
+    /* 0b10 */        +1,    0,    0,   -1,
+    /* 0b11 */         0,   -1,   +1,    0
 };
 
+static uint32_t port_state[GPIO_PORTS_CNT] SYS_HOT_BSS = {0}; // ports snapshot of the current pass
+static uint8_t ports_used = 0; // bit N = port N is used by an enabled channel
+
 // uses with GPIO module macros
 extern volatile uint32_t * gpio_port_data[GPIO_PORTS_CNT];
 
+/// phase state of the current channel from the ports snapshot
+#define PHASE_STATE(PH) \
+    ( (port_state[enc[c].port[PH]] & enc[c].pin_mask[PH]) ? 1 : 0 )
+
+
+
+
+// private functions
+
+SYS_HOT static void edge_save(uint8_t c, int8_t dir, uint64_t tick)
+{
+    // the direction was changed? start a new velocity window
+    if ( dir != enc[c].edge_dir ) enc[c].edge_cnt = 0;
+
+    enc[c].edge_dir = dir;
+    enc[c].edge_tick[enc[c].edge_head] = tick;
+
+    if ( ++enc[c].edge_head >= ENCODER_EDGES_CNT ) enc[c].edge_head = 0;
+    if ( enc[c].edge_cnt < ENCODER_EDGES_CNT ) ++enc[c].edge_cnt;
+}
+
+/// extend the 32-bit timestamp T of the recent past to 64 bits
+SYS_HOT static uint64_t tick_extend(uint32_t t)
+{
+    uint64_t now = timer_cnt_get_64();
+    return now - (uint32_t)((uint32_t)now - t);
+}
+
+static void update_ports_used()
+{
+    uint8_t c;
+
+    for ( ports_used = 0, c = ENCODER_CH_CNT; c--; )
+    {
+        if ( !enc[c].enabled ) continue;
+
+        ports_used |= 1U << enc[c].port[PH_A];
+        if ( enc[c].using_B ) ports_used |= 1U << enc[c].port[PH_B];
+#if ENCODER_INDEX
+        if ( enc[c].using_Z ) ports_used |= 1U << enc[c].port[PH_Z];
+#endif
+    }
+}
+
 
 
 
@@ -59,7 +104,7 @@ void encoder_module_init()
     uint8_t i = 0;
 
     // add message handlers
-    for ( i = ENCODER_MSG_PIN_SETUP; i <= ENCODER_MSG_COUNTS_GET; i++ )
+    for ( i = ENCODER_MSG_PIN_SETUP; i <= ENCODER_MSG_INDEX_GET; i++ )
     {
         msg_recv_callback_add(i, (msg_recv_func_t) encoder_msg_recv);
     }
@@ -70,52 +115,81 @@ void encoder_module_init()
  * @note    call this function anywhere in the main loop
  * @retval  none
  */
-void encoder_module_base_thread()
+SYS_HOT void encoder_module_base_thread()
 {
-    static uint8_t c = (ENCODER_CH_CNT - 1);
-    static uint32_t A, B, Z, AB;
+    static uint8_t c, p, A, B, AB;
+#if ENCODER_INDEX
+    static uint8_t Z;
+#endif
+    static int8_t d;
+    static uint32_t snap;
+    static uint64_t tick;
+
+    // no enabled channels?
+    if ( !ports_used ) return;
+
+    // read every used port only once
+    for ( p = GPIO_PORTS_CNT; p--; )
+    {
+        if ( ports_used & (1U << p) ) port_state[p] = *gpio_port_data[p];
+    }
 
-    if ( enc[c].enabled )
+    // timestamp of the ports snapshot, it's extended to 64 bits on the first edge only
+    snap = TIMER_CNT_GET();
+    tick = 0;
+
+    // decode all enabled channels from the ports snapshot
+    for ( c = ENCODER_CH_CNT; c--; )
     {
+        if ( !enc[c].enabled ) continue;
+
+#if ENCODER_INDEX
         if ( enc[c].using_Z ) // if we are using ABZ encoder
         {
-            Z = GPIO_PIN_GET(enc[c].port[PH_Z], enc[c].pin_mask[PH_Z]);
+            Z = PHASE_STATE(PH_Z);
 
             if ( enc[c].state[PH_Z] != Z ) // on phase Z state change
             {
-                if ( Z ) enc[c].counts = 0;
+                if ( Z )
+                {
+                    if ( !tick ) tick = tick_extend(snap);
+                    enc[c].index_tick = tick;
+                    enc[c].index_counts = enc[c].counts;
+                    enc[c].index_cnt++;
+                    enc[c].counts = 0;
+                }
                 enc[c].state[PH_Z] = Z;
             }
         }
+#endif
 
-        A = GPIO_PIN_GET(enc[c].port[PH_A], enc[c].pin_mask[PH_A]);
+        A = PHASE_STATE(PH_A);
 
         if ( enc[c].using_B ) // if we are using AB encoder
         {
-            B = GPIO_PIN_GET(enc[c].port[PH_B], enc[c].pin_mask[PH_B]);
-
-            if ( enc[c].state[PH_A] != A || enc[c].state[PH_B] != B ) // on any phase change
-            {
-                AB = (A ? 0b10 : 0) | (A ? 0b01 : 0); // get encoder state
+            B = PHASE_STATE(PH_B);
+            AB = (A << 1) | B;
 
-                if ( state_list[enc[c].AB_state] == AB ) enc[c].counts++; // CW
-                else                                     enc[c].counts--; // CCW
+            d = AB_transition[(enc[c].AB_state << 2) | AB];
+            enc[c].AB_state = AB;
+            enc[c].state[PH_B] = B;
 
-                enc[c].AB_state = AB;
+            if ( d )
+            {
+                if ( !tick ) tick = tick_extend(snap);
+                enc[c].counts += d;
+                edge_save(c, d, tick);
             }
-
-            enc[c].state[PH_B] = B;
         }
-        else if ( enc[c].state[PH_A] != A && A ) // if we are using A encoder and phase A is HIGH
+        else if ( A && !enc[c].state[PH_A] ) // if we are using A encoder and phase A is HIGH
         {
+            if ( !tick ) tick = tick_extend(snap);
             enc[c].counts++; // CW
+            edge_save(c, 1, tick);
         }
 
         enc[c].state[PH_A] = A;
     }
-
-    --c;
-    if ( !c ) c = (ENCODER_CH_CNT - 1);
 }
 
 
@@ -139,7 +213,9 @@ void encoder_pin_setup(uint8_t c, uint8_t phase, uint8_t port, uint8_t pin)
     // set phase pin parameters
     enc[c].port[phase] = port;
     enc[c].pin_mask[phase] = 1U << pin;
-    enc[c].state[phase] = GPIO_PIN_GET(port, enc[c].pin_mask[phase]);
+    enc[c].state[phase] = GPIO_PIN_GET(port, enc[c].pin_mask[phase]) ? 1 : 0;
+
+    update_ports_used();
 }
 
 
@@ -160,9 +236,14 @@ void encoder_setup(uint8_t c, uint8_t using_B, uint8_t using_Z)
     enc[c].using_B  = using_B;
     enc[c].using_Z  = using_Z;
 
-    // set encoder state
+    // set encoder state from the current pins state,
+    // the saved one is stale if the channel was disabled
+    enc[c].state[PH_A] = GPIO_PIN_GET(enc[c].port[PH_A], enc[c].pin_mask[PH_A]) ? 1 : 0;
+    enc[c].state[PH_B] = GPIO_PIN_GET(enc[c].port[PH_B], enc[c].pin_mask[PH_B]) ? 1 : 0;
     enc[c].AB_state = (enc[c].state[PH_A] ? 0b10 : 0) |
                       (enc[c].state[PH_B] ? 0b01 : 0);
+
+    update_ports_used();
 }
 
 /**
@@ -174,6 +255,9 @@ void encoder_setup(uint8_t c, uint8_t using_B, uint8_t using_Z)
 void encoder_state_set(uint8_t c, uint8_t state)
 {
     enc[c].enabled = state ? 1 : 0;
+    enc[c].edge_cnt = 0;
+
+    update_ports_used();
 }
 
 /**
@@ -213,6 +297,49 @@ int32_t encoder_counts_get(uint8_t c)
     return enc[c].counts;
 }
 
+/**
+ * @brief   get current velocity for the selected channel
+ *
+ * @note    velocity is averaged over the last ENCODER_EDGES_CNT edges,
+ *          it goes down to 0 if there are no new edges
+ *
+ * @param   c       channel id
+ * @param   period  pointer to the average counts period (in CPU ticks), 0 = unknown
+ * @param   edges   pointer to the number of averaged periods
+ *
+ * @retval  signed 32-bit number (counts per second)
+ */
+int32_t encoder_velocity_get(uint8_t c, uint32_t * period, uint32_t * edges)
+{
+    uint8_t last, first;
+    uint64_t span, idle;
+
+    *period = 0;
+    *edges = 0;
+
+    if ( c >= ENCODER_CH_CNT ) return 0;
+
+    // not enough data?
+    if ( enc[c].edge_cnt < 2 ) return 0;
+
+    last  = enc[c].edge_head ? enc[c].edge_head - 1 : ENCODER_EDGES_CNT - 1;
+    first = (last + ENCODER_EDGES_CNT + 1 - enc[c].edge_cnt) % ENCODER_EDGES_CNT;
+
+    *edges = enc[c].edge_cnt - 1;
+    span = enc[c].edge_tick[last] - enc[c].edge_tick[first];
+    idle = timer_cnt_get_64() - enc[c].edge_tick[last];
+
+    // no edges for a longer time than the average period? it's the period now
+    if ( idle * (*edges) > span ) span = idle * (*edges);
+
+    // too slow?
+    if ( (span / (*edges)) >> 32 ) return 0;
+
+    *period = (uint32_t) (span / (*edges));
+
+    return enc[c].edge_dir * (int32_t) ((uint64_t)TIMER_FREQUENCY * (*edges) / span);
+}
+
 
 
 
@@ -255,9 +382,9 @@ int8_t volatile encoder_msg_recv(uint8_t type, uint8_t * msg, uint8_t length)
         case ENCODER_MSG_STATE_GET:
         {
             struct encoder_msg_ch_t in = *((struct encoder_msg_ch_t *) msg);
-            struct encoder_msg_state_get_t out = *((struct encoder_msg_state_get_t *) &msg_buf);
-            out.state = encoder_state_get(in.ch);
-            msg_send(type, (uint8_t*)&out, 4);
+            struct encoder_msg_state_get_t *out = (struct encoder_msg_state_get_t *) msg_reserve();
+            out->state = encoder_state_get(in.ch);
+            msg_commit(type, 4);
             break;
         }
 
@@ -270,9 +397,35 @@ int8_t volatile encoder_msg_recv(uint8_t type, uint8_t * msg, uint8_t length)
         case ENCODER_MSG_COUNTS_GET:
         {
             struct encoder_msg_ch_t in = *((struct encoder_msg_ch_t *) msg);
-            struct encoder_msg_counts_get_t out = *((struct encoder_msg_counts_get_t *) &msg_buf);
-            out.counts = encoder_counts_get(in.ch);
-            msg_send(type, (uint8_t*)&out, 4);
+            struct encoder_msg_counts_get_t *out = (struct encoder_msg_counts_get_t *) msg_reserve();
+            out->counts = encoder_counts_get(in.ch);
+            msg_commit(type, 4);
+            break;
+        }
+
+        case ENCODER_MSG_VELOCITY_GET:
+        {
+            struct encoder_msg_ch_t in = *((struct encoder_msg_ch_t *) msg);
+            struct encoder_msg_velocity_get_t *out = (struct encoder_msg_velocity_get_t *) msg_reserve();
+            out->velocity = encoder_velocity_get(in.ch, &out->period, &out->edges);
+            msg_commit(type, sizeof(*out));
+            break;
+        }
+        case ENCODER_MSG_INDEX_GET:
+        {
+            struct encoder_msg_ch_t in = *((struct encoder_msg_ch_t *) msg);
+            struct encoder_msg_index_get_t *out;
+            uint64_t now;
+            if ( in.ch >= ENCODER_CH_CNT ) return -1;
+            out = (struct encoder_msg_index_get_t *) msg_reserve();
+            now = timer_cnt_get_64();
+            out->tick_lo = (uint32_t) enc[in.ch].index_tick;
+            out->tick_hi = (uint32_t) (enc[in.ch].index_tick >> 32);
+            out->now_lo = (uint32_t) now;
+            out->now_hi = (uint32_t) (now >> 32);
+            out->counts = enc[in.ch].index_counts;
+            out->cnt = enc[in.ch].index_cnt;
+            msg_commit(type, sizeof(*out));
             break;
         }
 
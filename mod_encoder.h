@@ -16,9 +16,25 @@
 
 
 
+#ifndef ENCODER_MODULE
+#define ENCODER_MODULE 1  ///< 0 = the module isn't used by the firmware
+#endif
+#ifndef ENCODER_CH_CNT
 #define ENCODER_CH_CNT 8  ///< maximum number of encoder counter channels
+#endif
 #define ENCODER_PH_CNT 3  ///< number of encoder phases
 
+#ifndef ENCODER_INDEX
+/// 1 = phase Z resets the counts
+#define ENCODER_INDEX 1
+#endif
+
+#ifndef ENCODER_EDGES_CNT
+/// number of the last edge timestamps used for the velocity,
+/// keep (ENCODER_EDGES_CNT - 1) a multiple of 4 for the AB encoders
+#define ENCODER_EDGES_CNT 9
+#endif
+
 
 
 
@@ -35,6 +51,15 @@ struct encoder_ch_t
 
     int32_t     counts;
     uint8_t     AB_state;
+
+    uint64_t    edge_tick[ENCODER_EDGES_CNT]; // timestamps of the last counts changes
+    uint8_t     edge_head; // next edge_tick[] slot
+    uint8_t     edge_cnt; // number of valid edge_tick[] slots
+    int8_t      edge_dir; // direction of the last counts change
+
+    uint64_t    index_tick; // timestamp of the last phase Z pulse
+    int32_t     index_counts; // counts before the last phase Z reset
+    uint32_t    index_cnt; // number of phase Z pulses
 };
 
 
@@ -51,12 +76,11 @@ enum
     ENCODER_MSG_STATE_SET,
     ENCODER_MSG_STATE_GET,
     ENCODER_MSG_COUNTS_SET,
-    ENCODER_MSG_COUNTS_GET
+    ENCODER_MSG_COUNTS_GET,
+    ENCODER_MSG_VELOCITY_GET,
+    ENCODER_MSG_INDEX_GET
 };
 
-/// the message data sizes
-#define ENCODER_MSG_BUF_LEN MSG_LEN
-
 /// the message data access
 struct encoder_msg_ch_t { uint32_t ch; };
 struct encoder_msg_pin_setup_t { uint32_t ch; uint32_t phase; uint32_t port; uint32_t pin; };
@@ -65,6 +89,14 @@ struct encoder_msg_state_set_t { uint32_t ch; uint32_t state; };
 struct encoder_msg_counts_set_t { uint32_t ch; int32_t counts; };
 struct encoder_msg_state_get_t { uint32_t state; };
 struct encoder_msg_counts_get_t { int32_t counts; };
+struct encoder_msg_velocity_get_t { int32_t velocity; uint32_t period; uint32_t edges; };
+struct encoder_msg_index_get_t
+{
+    uint32_t tick_lo; uint32_t tick_hi; // phase Z pulse timestamp
+    uint32_t now_lo; uint32_t now_hi; // current timestamp
+    int32_t counts; // counts before the phase Z reset
+    uint32_t cnt; // number of phase Z pulses
+};
 
 
 
@@ -82,6 +114,7 @@ void encoder_counts_set(uint8_t c, int32_t counts);
 
 uint8_t encoder_state_get(uint8_t c);
 int32_t encoder_counts_get(uint8_t c);
+int32_t encoder_velocity_get(uint8_t c, uint32_t * period, uint32_t * edges);
 int8_t volatile encoder_msg_recv(uint8_t type, uint8_t * msg, uint8_t length);
 
 
@@ -16,7 +16,7 @@
 
 // private vars
 
-volatile uint32_t * gpio_port_data[GPIO_PORTS_CNT] =
+volatile uint32_t * gpio_port_data[GPIO_PORTS_CNT] SYS_HOT_DATA =
 {
     (uint32_t *) ( (GPIO_BASE + PA * GPIO_BANK_SIZE) + 16 ),
     (uint32_t *) ( (GPIO_BASE + PB * GPIO_BANK_SIZE) + 16 ),
@@ -28,7 +28,15 @@ volatile uint32_t * gpio_port_data[GPIO_PORTS_CNT] =
     (uint32_t *) ( (GPIO_R_BASE                    ) + 16 )
 };
 
-static uint8_t msg_buf[GPIO_MSG_BUF_LEN] = {0};
+// uses with GPIO_PIN_SET_LATER/GPIO_PIN_CLEAR_LATER macros
+uint32_t gpio_port_set_mask[GPIO_PORTS_CNT] SYS_HOT_BSS = {0};
+uint32_t gpio_port_clear_mask[GPIO_PORTS_CNT] SYS_HOT_BSS = {0};
+uint8_t gpio_port_dirty = 0; // bit N = port N have pending changes
+
+// the batch must fit the message, 4 bits per port number of the `ports`
+typedef char gpio_msg_batch_size_check[(sizeof(struct gpio_msg_batch_t) <= MSG_LEN &&
+                                        GPIO_BATCH_ITEMS_CNT <= 8) ? 1 : -1];
+
 
 
 
@@ -74,7 +82,7 @@ void gpio_module_init()
     uint8_t i = 0;
 
     // add message handlers
-    for ( i = GPIO_MSG_SETUP_FOR_OUTPUT; i <= GPIO_MSG_PORT_CLEAR; i++ )
+    for ( i = GPIO_MSG_SETUP_FOR_OUTPUT; i < GPIO_MSG_CNT; i++ )
     {
         msg_recv_callback_add(i, (msg_recv_func_t) gpio_msg_recv);
     }
@@ -105,6 +113,18 @@ void gpio_pin_setup_for_input(uint32_t port, uint32_t pin)
     gpio_set_pincfg(port, pin, GPIO_FUNC_INPUT);
 }
 
+/**
+ * @brief   set pin mode to the peripheral function
+ * @param   port    GPIO port number    (0 .. GPIO_PORTS_CNT)
+ * @param   pin     GPIO pin number     (0 .. GPIO_PINS_CNT)
+ * @param   func    pin function        (GPIO_FUNC_INPUT .. 7)
+ * @retval  none
+ */
+void gpio_pin_setup_for_func(uint32_t port, uint32_t pin, uint32_t func)
+{
+    gpio_set_pincfg(port, pin, func);
+}
+
 
 
 
@@ -190,6 +210,91 @@ void gpio_port_clear(uint32_t port, uint32_t mask)
     *gpio_port_data[port] &= ~mask;
 }
 
+/**
+ * @brief   set and clear port pins state by masks with a single port write
+ *
+ * @param   port        GPIO port number        (0 .. GPIO_PORTS_CNT)
+ * @param   set_mask    GPIO pins mask to set   (0 .. 0xFFFFFFFF)
+ * @param   clear_mask  GPIO pins mask to clear (0 .. 0xFFFFFFFF)
+ *
+ * @note    pins of both masks will be set
+ *
+ * @retval  none
+ */
+void gpio_port_set_clear(uint32_t port, uint32_t set_mask, uint32_t clear_mask)
+{
+    *gpio_port_data[port] = (*gpio_port_data[port] & ~clear_mask) | set_mask;
+}
+
+/**
+ * @brief   update a list of ports and read their new states
+ *
+ * @param   batch   pointer to the port operations
+ * @param   cnt     number of port operations (0 .. GPIO_BATCH_ITEMS_CNT)
+ * @param   values  pointer to the `cnt` port states (masked by the items `read_mask`)
+ *
+ * @note    all ports are written one by one without any other thread between them,
+ *          and read back after the last write
+ *
+ * @retval  0 .. GPIO_BATCH_ITEMS_CNT (number of done port operations)
+ */
+uint8_t gpio_batch(struct gpio_msg_batch_t * batch, uint8_t cnt, uint32_t * values)
+{
+    uint8_t i, port;
+
+    if ( cnt > GPIO_BATCH_ITEMS_CNT ) cnt = GPIO_BATCH_ITEMS_CNT;
+
+    for ( i = 0; i < cnt; i++ )
+    {
+        port = GPIO_BATCH_PORT(batch->ports, i);
+        if ( port >= GPIO_PORTS_CNT ) { cnt = i; break; }
+        if ( !(batch->item[i].set_mask | batch->item[i].clear_mask) ) continue;
+
+        gpio_port_set_clear(port, batch->item[i].set_mask, batch->item[i].clear_mask);
+    }
+
+    for ( i = 0; i < cnt; i++ )
+    {
+        values[i] = *gpio_port_data[GPIO_BATCH_PORT(batch->ports, i)] & batch->item[i].read_mask;
+    }
+
+    return cnt;
+}
+
+
+
+
+/**
+ * @brief   write all pending pin changes to the ports
+ *
+ * @note    pin changes made by GPIO_PIN_SET_LATER/GPIO_PIN_CLEAR_LATER
+ *          are collected in the port masks and every touched port
+ *          is written only once by this function
+ *
+ * @retval  none
+ */
+SYS_HOT void gpio_port_flush()
+{
+    uint8_t port;
+
+    // nothing to write?
+    if ( !gpio_port_dirty ) return;
+
+    for ( port = GPIO_PORTS_CNT; port--; )
+    {
+        if ( !(gpio_port_dirty & (1U << port)) ) continue;
+
+        *gpio_port_data[port] =
+            (*gpio_port_data[port] & ~gpio_port_clear_mask[port]) |
+            gpio_port_set_mask[port];
+
+        gpio_port_set_mask[port] = 0;
+        gpio_port_clear_mask[port] = 0;
+    }
+
+    gpio_port_dirty = 0;
+}
+
 
 
 
@@ -226,9 +331,9 @@ int8_t volatile gpio_msg_recv(uint8_t type, uint8_t * msg, uint8_t length)
         case GPIO_MSG_PIN_GET:
         {
             struct gpio_msg_port_pin_t in = *((struct gpio_msg_port_pin_t *) msg);
-            struct gpio_msg_state_t out = *((struct gpio_msg_state_t *) &msg_buf);
-            out.state = gpio_pin_get(in.port, in.pin);
-            msg_send(type, (uint8_t*)&out, 4);
+            struct gpio_msg_state_t *out = (struct gpio_msg_state_t *) msg_reserve();
+            out->state = gpio_pin_get(in.port, in.pin);
+            msg_commit(type, 4);
             break;
         }
         case GPIO_MSG_PIN_SET:
@@ -247,9 +352,9 @@ int8_t volatile gpio_msg_recv(uint8_t type, uint8_t * msg, uint8_t length)
         case GPIO_MSG_PORT_GET:
         {
             struct gpio_msg_port_t in = *((struct gpio_msg_port_t *) msg);
-            struct gpio_msg_state_t out = *((struct gpio_msg_state_t *) &msg_buf);
-            out.state = gpio_port_get(in.port);
-            msg_send(type, (uint8_t*)&out, 4);
+            struct gpio_msg_state_t *out = (struct gpio_msg_state_t *) msg_reserve();
+            out->state = gpio_port_get(in.port);
+            msg_commit(type, 4);
             break;
         }
         case GPIO_MSG_PORT_SET:
@@ -265,6 +370,21 @@ int8_t volatile gpio_msg_recv(uint8_t type, uint8_t * msg, uint8_t length)
             break;
         }
 
+        case GPIO_MSG_PORT_SET_CLEAR:
+        {
+            struct gpio_msg_port_set_clear_t in = *((struct gpio_msg_port_set_clear_t *) msg);
+            gpio_port_set_clear(in.port, in.set_mask, in.clear_mask);
+            break;
+        }
+        case GPIO_MSG_BATCH:
+        {
+            struct gpio_msg_batch_t in = *((struct gpio_msg_batch_t *) msg);
+            uint8_t cnt = length > 4 ? (length - 4) / sizeof(struct gpio_msg_batch_item_t) : 0;
+            cnt = gpio_batch(&in, cnt, (uint32_t *) msg_reserve());
+            msg_commit(type, cnt * 4);
+            break;
+        }
+
         default: return -1;
     }
 
@@ -335,4 +455,31 @@ int8_t volatile gpio_msg_recv(uint8_t type, uint8_t * msg, uint8_t length)
             return 0;
         }
     @endcode
+
+    <b>Usage example 3</b>: coolant (PA6), enable (PA7) and brake (PL10) update, estop (PL11) input read:
+
+    @code
+        #include <stdint.h>
+        #include "mod_gpio.h"
+
+        int main(void)
+        {
+            struct gpio_msg_batch_t batch = {0};
+            uint32_t values[2];
+
+            // module init
+            gpio_module_init();
+
+            // item 0 = port A, item 1 = port L
+            batch.ports = PA | (PL << 4);
+            batch.item[0].set_mask = (1U << 6) | (1U << 7);
+            batch.item[1].clear_mask = 1U << 10;
+            batch.item[1].read_mask = 1U << 11;
+
+            // coolant and enable ON, brake OFF, values[1] = estop pin state
+            gpio_batch(&batch, 2, values);
+
+            return 0;
+        }
+    @endcode
 */
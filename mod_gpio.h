@@ -47,6 +47,8 @@ enum { PA, PB, PC, PD, PE, PF, PG, PL };
 #define GPIO_FUNC_BANK_A_I2C1   3
 #define GPIO_FUNC_BANK_E_I2C2   3
 #define GPIO_FUNC_BANK_L_I2C3   2
+#define GPIO_FUNC_BANK_A_PWM0   3
+#define GPIO_FUNC_BANK_L_S_PWM  2
 
 /// the GPIO pin states
 enum { LOW, HIGH };
@@ -63,17 +65,36 @@ enum
 
     GPIO_MSG_PORT_GET,
     GPIO_MSG_PORT_SET,
-    GPIO_MSG_PORT_CLEAR
-};
+    GPIO_MSG_PORT_CLEAR,
+
+    GPIO_MSG_PORT_SET_CLEAR,
+    GPIO_MSG_BATCH,
 
-/// the message data sizes
-#define GPIO_MSG_BUF_LEN MSG_LEN
+    GPIO_MSG_CNT
+};
 
 /// the message data access
 struct gpio_msg_port_t      { uint32_t port; };
 struct gpio_msg_port_pin_t  { uint32_t port; uint32_t pin;  };
 struct gpio_msg_port_mask_t { uint32_t port; uint32_t mask; };
 struct gpio_msg_state_t     { uint32_t state; };
+struct gpio_msg_port_set_clear_t { uint32_t port; uint32_t set_mask; uint32_t clear_mask; };
+
+/// a port operation of the GPIO_MSG_BATCH, `read_mask` = pins to return after the update
+struct gpio_msg_batch_item_t { uint32_t set_mask; uint32_t clear_mask; uint32_t read_mask; };
+
+/// max number of port operations in the GPIO_MSG_BATCH, the `ports` word is the header
+#define GPIO_BATCH_ITEMS_CNT    ((MSG_LEN - 4) / sizeof(struct gpio_msg_batch_item_t))
+/// GPIO_MSG_BATCH data, the item I port number is at the bits 4*I .. 4*I+3 of the `ports`
+struct gpio_msg_batch_t
+{
+    uint32_t ports;
+    struct gpio_msg_batch_item_t item[GPIO_BATCH_ITEMS_CNT];
+};
+
+/// port number of the batch item
+#define GPIO_BATCH_PORT(PORTS, I) \
+    ( ((PORTS) >> (4*(I))) & 0xF )
 
 
 
@@ -92,6 +113,18 @@ struct gpio_msg_state_t     { uint32_t state; };
 #define GPIO_PIN_GET(PORT,PIN_MASK) \
     (*gpio_port_data[PORT] & PIN_MASK)
 
+/// set pin state = 1 at the next gpio_port_flush() call
+#define GPIO_PIN_SET_LATER(PORT,PIN_MASK,PIN_MASK_NOT) \
+    ( gpio_port_set_mask[PORT] |= PIN_MASK, \
+      gpio_port_clear_mask[PORT] &= PIN_MASK_NOT, \
+      gpio_port_dirty |= 1U << (PORT) )
+
+/// set pin state = 0 at the next gpio_port_flush() call
+#define GPIO_PIN_CLEAR_LATER(PORT,PIN_MASK,PIN_MASK_NOT) \
+    ( gpio_port_clear_mask[PORT] |= PIN_MASK, \
+      gpio_port_set_mask[PORT] &= PIN_MASK_NOT, \
+      gpio_port_dirty |= 1U << (PORT) )
+
 
 
 
@@ -101,6 +134,7 @@ void gpio_module_init();
 
 void gpio_pin_setup_for_output(uint32_t port, uint32_t pin);
 void gpio_pin_setup_for_input(uint32_t port, uint32_t pin);
+void gpio_pin_setup_for_func(uint32_t port, uint32_t pin, uint32_t func);
 
 uint32_t gpio_pin_get(uint32_t port, uint32_t pin);
 void gpio_pin_set(uint32_t port, uint32_t pin);
@@ -109,6 +143,10 @@ void gpio_pin_clear(uint32_t port, uint32_t pin);
 uint32_t gpio_port_get(uint32_t port);
 void gpio_port_set(uint32_t port, uint32_t mask);
 void gpio_port_clear(uint32_t port, uint32_t mask);
+void gpio_port_set_clear(uint32_t port, uint32_t set_mask, uint32_t clear_mask);
+uint8_t gpio_batch(struct gpio_msg_batch_t * batch, uint8_t cnt, uint32_t * values);
+
+void gpio_port_flush();
 
 int8_t volatile gpio_msg_recv(uint8_t type, uint8_t * msg, uint8_t length);
 
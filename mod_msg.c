@@ -8,18 +8,57 @@
  */
 
 #include <string.h>
+#include "io.h"
+#include "sys.h"
 #include "mod_msg.h"
+#include "mod_timer.h"
 
 
 
 
 // private vars
 
-static struct msg_t * msg_arisc[MSG_MAX_CNT] = {0};
+static struct msg_t * msg_arisc[MSG_MAX_CNT] SYS_HOT_BSS = {0};
 static struct msg_t * msg_arm[MSG_MAX_CNT] = {0};
 
 static msg_recv_func_t msg_recv_callback[MSG_RECV_CALLBACK_CNT] = {0};
 
+#if MSG_RING
+static volatile struct msg_ring_ctrl_t * ring = (struct msg_ring_ctrl_t *) MSG_RING_CTRL_ADDR;
+#endif
+
+static struct msg_t * reserved = 0; // slot of the msg_reserve(), 0 = nothing reserved
+static uint8_t reserved_m = 0;
+static struct msg_t scratch = {0}; // reserved if there is no free slot
+
+#if MSG_RECV_TICKS_BUDGET
+/// the message processing time since the START tick is over?
+#define BUDGET_OVER(START) ( (TIMER_CNT_GET() - (START)) >= MSG_RECV_TICKS_BUDGET )
+#else
+#define BUDGET_OVER(START) 0
+#endif
+
+
+
+
+// private functions
+
+SYS_HOT static void recv(uint8_t m)
+{
+    // if we have a callback for this message type
+    if ( msg_recv_callback[msg_arm[m]->type] )
+    {
+        // message handlers are never interrupted by the channels processing
+        TIMER_IRQ_LOCK();
+        // call function with message data as parameters
+        (*msg_recv_callback[msg_arm[m]->type])(msg_arm[m]->type, msg_arm[m]->msg, msg_arm[m]->length);
+        TIMER_IRQ_UNLOCK();
+    }
+
+    // message read
+    msg_arm[m]->unread = 0;
+}
+
 
 
 
@@ -36,6 +75,9 @@ void msg_module_init(void)
 
     // messages memory block cleanup
     memset((uint8_t*)MSG_BLOCK_ADDR, 0, MSG_BLOCK_SIZE);
+#if MSG_RING
+    memset((uint8_t*)MSG_RING_CTRL_ADDR, 0, MSG_RING_CTRL_SIZE);
+#endif
 
     // assign messages pointers
     for ( ; m < MSG_MAX_CNT; ++m )
@@ -43,80 +85,297 @@ void msg_module_init(void)
         msg_arisc[m] = (struct msg_t *) (MSG_ARISC_BLOCK_ADDR + m * MSG_MAX_LEN);
         msg_arm[m]   = (struct msg_t *) (MSG_ARM_BLOCK_ADDR   + m * MSG_MAX_LEN);
     }
+
+#if MSG_DOORBELL
+    uint32_t reg;
+
+    // msgbox clock gating and reset
+    reg = readl(BUS_CLK_GATING_REG1);
+    reg |= MSGBOX_GATING;
+    writel(reg, BUS_CLK_GATING_REG1);
+
+    reg = readl(BUS_SOFT_RST_REG1);
+    reg |= MSGBOX_RST;
+    writel(reg, BUS_SOFT_RST_REG1);
+
+    // ARISC -> ARM channel: user 1 transmits, user 0 receives
+    reg = readl(MSGBOX_CTRL_REG(MSG_DOORBELL_TX_CH));
+    reg &= ~MSGBOX_CTRL_RX_USER1(MSG_DOORBELL_TX_CH);
+    reg |=  MSGBOX_CTRL_TX_USER1(MSG_DOORBELL_TX_CH);
+    writel(reg, MSGBOX_CTRL_REG(MSG_DOORBELL_TX_CH));
+
+    // ARM -> ARISC channel: user 0 transmits, user 1 receives
+    reg = readl(MSGBOX_CTRL_REG(MSG_DOORBELL_RX_CH));
+    reg &= ~MSGBOX_CTRL_TX_USER1(MSG_DOORBELL_RX_CH);
+    reg |=  MSGBOX_CTRL_RX_USER1(MSG_DOORBELL_RX_CH);
+    writel(reg, MSGBOX_CTRL_REG(MSG_DOORBELL_RX_CH));
+
+    // drop old doorbells
+    while ( readl(MSGBOX_MSG_STAT_REG(MSG_DOORBELL_RX_CH)) & MSGBOX_MSG_STAT_MASK )
+    {
+        reg = readl(MSGBOX_MSG_DATA_REG(MSG_DOORBELL_RX_CH));
+    }
+#endif
 }
 
 /**
  * @brief   module base thread
+ *
  * @note    call this function at the top of main loop
+ *
+ * @note    unread messages are processed one by one,
+ *          until the MSG_RECV_TICKS_BUDGET time is over,
+ *          but not more than MSG_MAX_CNT messages per call
+ *
+ * @note    if MSG_DOORBELL is enabled, every ARM doorbell
+ *          holds a slot number of the new message,
+ *          with MSG_RING the doorbells are only drained
+ *
  * @retval  none
  */
-void msg_module_base_thread(void)
+#if MSG_RING
+SYS_HOT void msg_module_base_thread(void)
 {
-    static uint8_t m = 0;
+    uint32_t head = ring->arm_head;
+    uint8_t m, cnt;
+#if MSG_RECV_TICKS_BUDGET
+    uint32_t start = TIMER_CNT_GET();
+#endif
+
+#if MSG_DOORBELL
+    // the ring tail says it all, just drop the doorbells, so the ARM never sees the FIFO full
+    while ( readl(MSGBOX_MSG_STAT_REG(MSG_DOORBELL_RX_CH)) & MSGBOX_MSG_STAT_MASK )
+    {
+        m = readl(MSGBOX_MSG_DATA_REG(MSG_DOORBELL_RX_CH));
+    }
+#endif
 
-    // process only one unread message per base thread
-    if ( msg_arm[m]->unread )
+    // process new messages in the ring order
+    for ( cnt = MSG_MAX_CNT; cnt-- && head != ring->arm_tail; )
     {
-        // if we have a callback for this message type
-        if ( msg_recv_callback[msg_arm[m]->type] )
-        {
-            // call function with message data as parameters
-            (*msg_recv_callback[msg_arm[m]->type])(msg_arm[m]->type, msg_arm[m]->msg, msg_arm[m]->length);
-        }
+        m = head & (MSG_MAX_CNT - 1);
+
+        // the ARM wrote this slot out of order?
+        if ( msg_arm[m]->unread != (uint8_t)head ) ++ring->arm_seq_errors;
+
+        recv(m);
+
+        // release the slot
+        msync();
+        ring->arm_head = ++head;
 
-        // message read
-        msg_arm[m]->unread = 0;
+        if ( BUDGET_OVER(start) ) break;
     }
+}
+#else
+SYS_HOT void msg_module_base_thread(void)
+{
+    static uint8_t hint = 0; // slot of the last processed message
+    static uint8_t scan = 0; // slot to check if there is nothing at the hint slot
+    uint8_t m = hint, cnt;
+#if MSG_RECV_TICKS_BUDGET
+    uint32_t start = TIMER_CNT_GET();
+#endif
+
+#if MSG_DOORBELL
+    // process messages announced by the ARM
+    while ( readl(MSGBOX_MSG_STAT_REG(MSG_DOORBELL_RX_CH)) & MSGBOX_MSG_STAT_MASK )
+    {
+        m = readl(MSGBOX_MSG_DATA_REG(MSG_DOORBELL_RX_CH)) % MSG_MAX_CNT;
+        if ( !msg_arm[m]->unread ) continue;
+
+        recv(m);
+        hint = m;
+
+        if ( BUDGET_OVER(start) ) return;
+    }
+
+    m = hint;
+#endif
+
+    // no message at the hint slot? check one more slot
+    if ( !msg_arm[m]->unread )
+    {
+        if ( ++scan >= MSG_MAX_CNT ) scan = 0;
+        if ( !msg_arm[scan]->unread ) return;
+        m = scan;
+    }
+
+    // process unread messages while we have a time
+    for ( cnt = MSG_MAX_CNT; cnt-- && msg_arm[m]->unread; )
+    {
+        recv(m);
+        hint = m;
 
-    ++m;
-    if ( m >= MSG_MAX_CNT ) m = 0;
+        if ( BUDGET_OVER(start) ) break;
+        if ( ++m >= MSG_MAX_CNT ) m = 0;
+    }
 }
+#endif
 
 
 
 
 /**
- * @brief   send a message to the ARM cpu
+ * @brief   check for a free ARISC message slot
  *
- * @param   type    user defined message type (0..0xFF)
- * @param   msg     pointer to the message buffer
- * @param   length  the length of a message (0 ..MSG_LEN)
+ * @note    use it before msg_reserve() if the message will be sent again later,
+ *          so a stalled message isn't counted as a drop at every try
  *
- * @retval   0 (message sent)
- * @retval  -1 (message not sent)
+ * @retval  0 (all slots are busy)
+ * @retval  1 (msg_reserve() will return a slot)
  */
-int8_t msg_send(uint8_t type, uint8_t * msg, uint8_t length)
+uint8_t msg_slot_free(void)
+{
+#if MSG_RING
+    return (ring->arisc_tail - ring->arisc_head) < MSG_MAX_CNT ? 1 : 0;
+#else
+    uint8_t m;
+
+    if ( reserved && reserved != &scratch && !reserved->unread ) return 1;
+    for ( m = MSG_MAX_CNT; m--; ) if ( !msg_arisc[m]->unread ) return 1;
+
+    return 0;
+#endif
+}
+
+/**
+ * @brief   reserve a free message slot to build the message in place
+ *
+ * @note    the same slot is returned until msg_commit() is called,
+ *          if all slots are busy the pointer of a scratch buffer is returned
+ *          and msg_commit() will drop the message
+ *
+ * @retval  pointer to the message payload (MSG_LEN bytes)
+ */
+#if MSG_RING
+uint8_t * msg_reserve(void)
+{
+    uint32_t tail = ring->arisc_tail;
+
+    // ring is full?
+    if ( (tail - ring->arisc_head) >= MSG_MAX_CNT ) reserved = &scratch;
+    else
+    {
+        reserved_m = tail & (MSG_MAX_CNT - 1);
+        reserved = msg_arisc[reserved_m];
+    }
+
+    return reserved->msg;
+}
+#else
+uint8_t * msg_reserve(void)
 {
     static uint8_t last = 0;
-    static uint8_t m = 0;
-    static uint8_t i = 0;
+    uint8_t i, m;
+
+    // the reserved slot is still free?
+    if ( reserved && reserved != &scratch && !reserved->unread ) return reserved->msg;
 
     // find next free message slot
     for ( i = MSG_MAX_CNT, m = last; i--; )
     {
-        // sending message
         if ( !msg_arisc[m]->unread )
         {
-            // copy message to the buffer
-            memset( (uint8_t*) ((uint8_t*)&msg_arisc[m]->msg + length/4*4), 0, 4 );
-            memcpy(&msg_arisc[m]->msg, msg, length);
-
-            // set message data
-            msg_arisc[m]->type   = type;
-            msg_arisc[m]->length = length;
-            msg_arisc[m]->unread = 1;
-
-            // message sent
             last = m;
-            return 0;
+            reserved_m = m;
+            reserved = msg_arisc[m];
+            return reserved->msg;
         }
 
         ++m;
         if ( m >= MSG_MAX_CNT ) m = 0;
     }
 
-    // message not sent
-    return -1;
+    reserved = &scratch;
+    return reserved->msg;
+}
+#endif
+
+/**
+ * @brief   send the message built in the msg_reserve() slot to the ARM cpu
+ *
+ * @param   type    user defined message type (0..0xFF)
+ * @param   length  the length of a message (0 ..MSG_LEN)
+ *
+ * @retval   0 (message sent)
+ * @retval  -1 (message not sent)
+ */
+int8_t msg_commit(uint8_t type, uint8_t length)
+{
+    struct msg_t * slot = reserved;
+    uint8_t i;
+
+    reserved = 0;
+
+    // nothing reserved? OR no free slot?
+    if ( !slot ) return -1;
+    if ( slot == &scratch )
+    {
+#if MSG_RING
+        ++ring->arisc_drops;
+#endif
+        return -1;
+    }
+
+    // zero the rest of the last word
+    if ( length > MSG_LEN ) length = MSG_LEN;
+    for ( i = length; i & 3; i++ ) slot->msg[i] = 0;
+
+    // set message data
+    slot->type   = type;
+    slot->length = length;
+
+#if MSG_RING
+    uint32_t tail = ring->arisc_tail;
+
+    slot->unread = (uint8_t)tail;
+
+    // publish the slot
+    msync();
+    ring->arisc_tail = ++tail;
+
+#if MSG_DOORBELL
+    // ring the ARM doorbell with the number of written messages
+    if ( !(readl(MSGBOX_FIFO_STAT_REG(MSG_DOORBELL_TX_CH)) & MSGBOX_FIFO_FULL) )
+    {
+        writel(tail, MSGBOX_MSG_DATA_REG(MSG_DOORBELL_TX_CH));
+    }
+#endif
+#else
+    slot->unread = 1;
+
+#if MSG_DOORBELL
+    // ring the ARM doorbell with the slot number,
+    // full fifo means the ARM will find this message anyway
+    msync();
+    if ( !(readl(MSGBOX_FIFO_STAT_REG(MSG_DOORBELL_TX_CH)) & MSGBOX_FIFO_FULL) )
+    {
+        writel(reserved_m, MSGBOX_MSG_DATA_REG(MSG_DOORBELL_TX_CH));
+    }
+#endif
+#endif
+
+    return 0;
+}
+
+/**
+ * @brief   send a message to the ARM cpu
+ *
+ * @note    use msg_reserve() and msg_commit() to build the message
+ *          in place without the copy
+ *
+ * @param   type    user defined message type (0..0xFF)
+ * @param   msg     pointer to the message buffer
+ * @param   length  the length of a message (0 ..MSG_LEN)
+ *
+ * @retval   0 (message sent)
+ * @retval  -1 (message not sent)
+ */
+int8_t msg_send(uint8_t type, uint8_t * msg, uint8_t length)
+{
+    memcpy(msg_reserve(), msg, length > MSG_LEN ? MSG_LEN : length);
+    return msg_commit(type, length);
 }
 
 
@@ -196,4 +455,24 @@ void msg_recv_callback_remove(uint8_t msg_type)
             return 0;
         }
     @endcode
+
+    <b>Usage example 2</b>: reply built in place of the message slot
+
+    @code
+        #include <stdint.h>
+        #include "mod_msg.h"
+
+        // callback for the `message received` event
+        int32_t volatile msg_received(uint8_t type, uint8_t * msg, uint8_t length)
+        {
+            u32_10_t *in = (u32_10_t*) msg;
+            u32_10_t *out = (u32_10_t*) msg_reserve();
+
+            // no copy of the reply
+            out->v[0] = in->v[0] + 1;
+            msg_commit(type, 4);
+
+            return 0;
+        }
+    @endcode
 */
@@ -16,7 +16,9 @@
 
 
 #define SRAM_A2_SIZE            (48*1024)
+#ifndef SRAM_A2_ADDR
 #define SRAM_A2_ADDR            0x00000000 ///< for ARM use 0x00040000
+#endif
 #define ARISC_CONF_SIZE         2048
 #define ARISC_CONF_ADDR         (SRAM_A2_ADDR + SRAM_A2_SIZE - ARISC_CONF_SIZE)
 
@@ -33,13 +35,44 @@
 
 #define MSG_RECV_CALLBACK_CNT   256
 
+#ifndef MSG_DOORBELL
+/// 1 = use the H3 message box hardware as a doorbell for the new messages
+#define MSG_DOORBELL            0
+#endif
+#define MSG_DOORBELL_TX_CH      0 ///< msgbox channel for ARISC -> ARM doorbells
+#define MSG_DOORBELL_RX_CH      1 ///< msgbox channel for ARM -> ARISC doorbells
+
+/* msgbox, user 0 = ARM, user 1 = ARISC */
+#define MSGBOX_BASE             0x01c17000
+#define MSGBOX_CTRL_REG(n)      (MSGBOX_BASE + 0x0000 + 0x4 * ((n) / 4))
+#define MSGBOX_CTRL_RX_USER1(n) BIT(0 + 8 * ((n) % 4))
+#define MSGBOX_CTRL_TX_USER1(n) BIT(4 + 8 * ((n) % 4))
+#define MSGBOX_FIFO_STAT_REG(n) (MSGBOX_BASE + 0x0100 + 0x4 * (n))
+#define MSGBOX_FIFO_FULL        BIT(0)
+#define MSGBOX_MSG_STAT_REG(n)  (MSGBOX_BASE + 0x0140 + 0x4 * (n))
+#define MSGBOX_MSG_STAT_MASK    0x7
+#define MSGBOX_MSG_DATA_REG(n)  (MSGBOX_BASE + 0x0180 + 0x4 * (n))
+
+#ifndef MSG_RING
+/// 1 = message slots are used as single producer / single consumer rings
+#define MSG_RING                0
+#endif
+#define MSG_RING_CTRL_ADDR      (ARISC_CONF_ADDR + 0) ///< rings control block
+#define MSG_RING_CTRL_SIZE      128
+
+#ifndef MSG_RECV_TICKS_BUDGET
+/// time (in CPU ticks) to process messages in one base thread call,
+/// 0 = no time limit, all unread messages per base thread call
+#define MSG_RECV_TICKS_BUDGET   2250
+#endif
+
 
 
 
 #pragma pack(push, 1)
 struct msg_t
 {
-    uint8_t unread;
+    uint8_t unread; // sequence number if MSG_RING == 1
     uint8_t locked; // actually not used at this moment
     uint8_t type;
     uint8_t length;
@@ -47,6 +80,22 @@ struct msg_t
 };
 #pragma pack(pop)
 
+/// rings control block (MSG_RING == 1), each 64-byte line is written by one CPU only
+struct msg_ring_ctrl_t
+{
+    // written by ARISC
+    uint32_t arm_head;          // number of ARM messages read
+    uint32_t arisc_tail;        // number of ARISC messages written
+    uint32_t arisc_drops;       // ARISC messages dropped on full ring
+    uint32_t arm_seq_errors;    // ARM messages with a wrong sequence number
+    uint32_t arisc_rsvd[12];
+
+    // written by ARM
+    uint32_t arm_tail;          // number of ARM messages written
+    uint32_t arisc_head;        // number of ARISC messages read
+    uint32_t arm_rsvd[14];
+};
+
 typedef int32_t (*msg_recv_func_t)(uint8_t, uint8_t*, uint8_t);
 
 typedef struct { uint32_t v[10]; } u32_10_t;
@@ -61,6 +110,9 @@ void msg_module_init(void);
 void msg_module_base_thread(void);
 
 int8_t msg_send(uint8_t type, uint8_t * msg, uint8_t length);
+uint8_t msg_slot_free(void);
+uint8_t * msg_reserve(void);
+int8_t msg_commit(uint8_t type, uint8_t length);
 
 void msg_recv_callback_add(uint8_t msg_type, msg_recv_func_t func);
 void msg_recv_callback_remove(uint8_t msg_type);
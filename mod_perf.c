@@ -0,0 +1,205 @@
+/**
+ * @file    mod_perf.c
+ *
+ * @brief   performance counters module
+ *
+ * This module implements an API to measure the base threads
+ * execution time and the channels pulse lateness
+ */
+
+#include <string.h>
+#include "mod_perf.h"
+
+#if PERF
+
+
+
+
+// private vars
+
+static struct perf_thread_t thread_data[PERF_THREAD_CNT] = {{0}};
+static uint16_t hist[STEPGEN_CH_CNT][PERF_HIST_CNT] = {{0}};
+static uint32_t lateness_max[STEPGEN_CH_CNT] = {0};
+static uint32_t loop_tick = 0;
+
+
+
+
+// public methods
+
+/**
+ * @brief   module init
+ * @note    call this function only once before any other module
+ * @retval  none
+ */
+void perf_module_init()
+{
+    uint8_t i = 0;
+
+    perf_reset();
+
+    // add message handlers
+    for ( i = PERF_MSG_THREAD_GET; i < PERF_MSG_CNT; i++ )
+    {
+        msg_recv_callback_add(i, (msg_recv_func_t) perf_msg_recv);
+    }
+}
+
+/**
+ * @brief   measure the main loop pass time
+ * @note    call this function at the top of main loop
+ * @retval  none
+ */
+void perf_loop()
+{
+    uint32_t now = TIMER_CNT_GET();
+
+    if ( loop_tick ) perf_thread_save(PERF_THREAD_LOOP, now - loop_tick);
+
+    loop_tick = now;
+}
+
+/**
+ * @brief   save the thread execution time
+ * @param   thread  PERF_THREAD_LOOP..PERF_THREAD_CNT-1
+ * @param   ticks   execution time (in CPU ticks)
+ * @retval  none
+ */
+void perf_thread_save(uint8_t thread, uint32_t ticks)
+{
+    struct perf_thread_t *t = &thread_data[thread];
+
+    if ( ticks < t->min ) t->min = ticks;
+    if ( ticks > t->max ) t->max = ticks;
+
+    // avg = avg + (ticks - avg)/16
+    t->avg = t->cnt ? t->avg + ticks - (t->avg >> 4) : ticks << 4;
+    t->cnt++;
+}
+
+/**
+ * @brief   save the channel pulse lateness
+ *
+ * @note    bucket 0 is for 0 ticks, bucket N is for 2^(N-1) .. 2^N-1 ticks,
+ *          the last bucket is for all bigger values
+ *
+ * @param   c       channel id
+ * @param   ticks   pulse lateness (in CPU ticks)
+ *
+ * @retval  none
+ */
+void perf_lateness_save(uint8_t c, uint32_t ticks)
+{
+    uint8_t b = 0;
+
+    // a negative lateness is an early pulse
+    if ( (int32_t)ticks < 0 ) ticks = 0;
+
+    if ( ticks > lateness_max[c] ) lateness_max[c] = ticks;
+
+    for ( ; ticks && b < (PERF_HIST_CNT - 1); ticks >>= 1 ) b++;
+
+    if ( hist[c][b] < UINT16_MAX ) hist[c][b]++;
+}
+
+/**
+ * @brief   get the thread execution time
+ * @param   thread  PERF_THREAD_LOOP..PERF_THREAD_CNT-1
+ * @param   t       pointer to the result (avg is in CPU ticks)
+ * @retval  none
+ */
+void perf_thread_get(uint8_t thread, struct perf_thread_t * t)
+{
+    *t = thread_data[thread];
+    t->avg >>= 4;
+}
+
+/**
+ * @brief   get the worst pulse lateness of the channel
+ * @param   c   channel id
+ * @retval  0..UINT32_MAX (in CPU ticks)
+ */
+uint32_t perf_lateness_max_get(uint8_t c)
+{
+    return lateness_max[c];
+}
+
+/**
+ * @brief   get the pulse lateness histogram of the channel
+ * @param   c   channel id
+ * @retval  pointer to PERF_HIST_CNT buckets, see perf_lateness_save()
+ */
+const uint16_t * perf_hist_get(uint8_t c)
+{
+    return hist[c];
+}
+
+/**
+ * @brief   reset all counters
+ * @retval  none
+ */
+void perf_reset()
+{
+    uint8_t i;
+
+    memset(thread_data, 0, sizeof(thread_data));
+    memset(hist, 0, sizeof(hist));
+    memset(lateness_max, 0, sizeof(lateness_max));
+
+    for ( i = PERF_THREAD_CNT; i--; ) thread_data[i].min = UINT32_MAX;
+
+    loop_tick = 0;
+}
+
+
+
+
+/**
+ * @brief   "message received" callback
+ *
+ * @note    this function will be called automatically
+ *          when a new message will arrive for this module.
+ *
+ * @param   type    user defined message type (0..0xFF)
+ * @param   msg     pointer to the message buffer
+ * @param   length  the length of a message (0 .. MSG_LEN)
+ *
+ * @retval   0 (message read)
+ * @retval  -1 (message not read)
+ */
+int8_t volatile perf_msg_recv(uint8_t type, uint8_t * msg, uint8_t length)
+{
+    u32_10_t *in = (u32_10_t*) msg;
+    u32_10_t *out;
+
+    switch (type)
+    {
+        case PERF_MSG_THREAD_GET:
+            if ( in->v[0] >= PERF_THREAD_CNT ) return -1;
+            out = (u32_10_t*) msg_reserve();
+            out->v[0] = thread_data[in->v[0]].min;
+            out->v[1] = thread_data[in->v[0]].max;
+            out->v[2] = thread_data[in->v[0]].avg >> 4;
+            out->v[3] = thread_data[in->v[0]].cnt;
+            msg_commit(type, 4*4);
+            break;
+        case PERF_MSG_HIST_GET:
+            if ( in->v[0] >= STEPGEN_CH_CNT ) return -1;
+            out = (u32_10_t*) msg_reserve();
+            memcpy(out, hist[in->v[0]], sizeof(hist[0]));
+            msg_commit(type, sizeof(hist[0]));
+            break;
+        case PERF_MSG_RESET:
+            perf_reset();
+            break;
+
+        default: return -1;
+    }
+
+    return 0;
+}
+
+
+
+
+#endif
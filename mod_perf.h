@@ -0,0 +1,107 @@
+/**
+ * @file    mod_perf.h
+ *
+ * @brief   performance counters module header
+ *
+ * This module implements an API to measure the base threads
+ * execution time and the channels pulse lateness
+ */
+
+#ifndef _MOD_PERF_H
+#define _MOD_PERF_H
+
+#include <stdint.h>
+#include "mod_msg.h"
+#include "mod_timer.h"
+#include "mod_stepgen.h"
+
+
+
+
+#ifndef PERF
+/// 1 = measure threads time and pulses lateness
+#define PERF                    0
+#endif
+
+#define PERF_HIST_CNT           16  ///< lateness histogram size (log2 buckets)
+
+
+
+
+/// measured threads
+enum
+{
+    PERF_THREAD_LOOP,   // whole main loop pass
+    PERF_THREAD_MSG,
+    PERF_THREAD_ENCODER,
+    PERF_THREAD_SCHED,  // stepgen and pulsgen channels
+    PERF_THREAD_STATUS,
+    PERF_THREAD_WAVE,   // waveform buffer refill
+    PERF_THREAD_CAPTURE,
+    PERF_THREAD_STEPGEN, // closed loop corrections
+    PERF_THREAD_CONF,   // stack canary check
+    PERF_THREAD_CNT
+};
+
+/// thread time (in CPU ticks)
+struct perf_thread_t
+{
+    uint32_t    min;
+    uint32_t    max;
+    uint32_t    avg;    // exponential moving average, Q4
+    uint32_t    cnt;    // number of measures
+};
+
+/// messages types
+enum
+{
+    PERF_MSG_THREAD_GET = 0x60,
+    PERF_MSG_HIST_GET,
+    PERF_MSG_RESET,
+    PERF_MSG_CNT
+};
+
+
+
+
+// public methods as macros
+
+#if PERF
+/// measure the execution time of the CALL
+#define PERF_CALL(THREAD, CALL) \
+    do { uint32_t perf_t0 = TIMER_CNT_GET(); CALL; perf_thread_save(THREAD, TIMER_CNT_GET() - perf_t0); } while (0)
+
+/// save the channel pulse lateness (in CPU ticks)
+#define PERF_LATENESS(C, TICKS) \
+    perf_lateness_save(C, TICKS)
+
+/// measure the time between main loop passes
+#define PERF_LOOP() \
+    perf_loop()
+#else
+#define PERF_CALL(THREAD, CALL) CALL
+#define PERF_LATENESS(C, TICKS)
+#define PERF_LOOP()
+#endif
+
+
+
+
+// export public methods
+
+#if PERF
+void perf_module_init();
+void perf_loop();
+void perf_thread_save(uint8_t thread, uint32_t ticks);
+void perf_lateness_save(uint8_t c, uint32_t ticks);
+void perf_thread_get(uint8_t thread, struct perf_thread_t * t);
+uint32_t perf_lateness_max_get(uint8_t c);
+const uint16_t * perf_hist_get(uint8_t c);
+void perf_reset();
+int8_t volatile perf_msg_recv(uint8_t type, uint8_t * msg, uint8_t length);
+#endif
+
+
+
+
+#endif
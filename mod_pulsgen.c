@@ -9,6 +9,7 @@
 
 #include "mod_timer.h"
 #include "mod_gpio.h"
+#include "mod_sched.h"
 #include "mod_pulsgen.h"
 
 
@@ -16,15 +17,20 @@
 
 // private vars
 
-static uint8_t max_id = 0; // maximum channel id
-static struct pulsgen_ch_t gen[PULSGEN_CH_CNT] = {0}; // array of channels data
-static uint8_t msg_buf[PULSGEN_MSG_BUF_LEN] = {0};
-static uint64_t tick = 0, wd_ticks = 0, wd_todo_tick = 0;
+// hot channels state first, pins setup and fifo data separately
+static struct pulsgen_ch_t gen[PULSGEN_CH_CNT] SYS_HOT_BSS = {{0}}; // array of channels data
+static struct pulsgen_pin_t pins[PULSGEN_CH_CNT] = {{0}}; // array of channels pins
+static uint32_t wd_ticks = 0, wd_todo_tick = 0;
+static uint8_t wd_enabled = 0, wd_scheduled = 0;
 static struct pulsgen_fifo_item_t fifo[PULSGEN_CH_CNT][PULSGEN_FIFO_SIZE] = {{0}};
-static uint8_t fifo_pos[PULSGEN_CH_CNT] = {0};
+static uint8_t fifo_head[PULSGEN_CH_CNT] = {0}; // next task to do, free running index
+static uint8_t fifo_tail[PULSGEN_CH_CNT] = {0}; // next free item, free running index
 
 // uses with GPIO module macros
 extern volatile uint32_t * gpio_port_data[GPIO_PORTS_CNT];
+extern uint32_t gpio_port_set_mask[GPIO_PORTS_CNT];
+extern uint32_t gpio_port_clear_mask[GPIO_PORTS_CNT];
+extern uint8_t gpio_port_dirty;
 
 
 
@@ -39,107 +45,127 @@ static void task_setup
     uint32_t toggles,
     uint32_t pin_setup_time,
     uint32_t pin_hold_time,
-    uint32_t start_delay
+    uint32_t start_delay,
+    uint32_t tick
 );
 
 
 
 
 
-// public methods
+// private functions
 
-/**
- * @brief   module init
- * @note    call this function only once before pulsgen_module_base_thread()
- * @retval  none
- */
-void pulsgen_module_init()
+static int8_t watchdog(uint32_t * deadline)
 {
-    uint8_t i = 0;
+    uint8_t c;
 
-    // start sys timer
-    TIMER_START();
+    // watchdog disabled?
+    if ( !wd_enabled ) { wd_scheduled = 0; return -1; }
 
-    // add message handlers
-    for ( i = PULSGEN_MSG_PIN_SETUP; i < PULSGEN_MSG_CNT; i++ )
+    // the wait time was updated by a message?
+    if ( !TIMER_TICK_DUE(wd_todo_tick, sched_tick) ) { *deadline = wd_todo_tick; return 0; }
+
+    // disable watchdog
+    wd_enabled = 0;
+    wd_scheduled = 0;
+
+    // abort all active channels
+    for ( c = PULSGEN_CH_CNT; c--; )
     {
-        msg_recv_callback_add(i, (msg_recv_func_t) pulsgen_msg_recv);
+        if ( !gen[c].task ) continue;
+        sched_remove(SCHED_ID(SCHED_PULSGEN, c));
+        abort(c);
     }
+
+    return -1;
 }
 
-/**
- * @brief   module base thread
- * @note    call this function in the main loop, before gpio_module_base_thread()
- * @retval  none
- */
-void pulsgen_module_base_thread()
+SYS_HOT static int8_t sched_process(uint8_t c, uint32_t * deadline)
 {
-    static uint8_t c, abort_all = 0;
-
-    // get current CPU tick
-    tick = timer_cnt_get_64();
+    if ( c == SCHED_WATCHDOG_CH ) return watchdog(deadline);
 
-    // have we a watchdog? && watchdog time is over?
-    if ( wd_todo_tick && tick > wd_todo_tick ) abort_all = 1; // set abort flag
+    // channel disabled?
+    if ( !gen[c].task ) return -1;
 
-    // check all working channels
-    for ( c = max_id + 1; c--; )
+    // no steps to do?
+    if ( !gen[c].task_toggles_todo && !gen[c].task_infinite )
     {
-        // channel disabled?
-        if ( !gen[c].task ) continue;
-        // watchdog time is over?
-        if ( abort_all ) { abort(c); continue; }
-        // it's not a time for a pulse?
-        if ( tick < gen[c].todo_tick ) continue;
-        // no steps to do?
-        if ( !gen[c].task_toggles_todo && !gen[c].task_infinite )
-        {
-            // goto new fifo item
-            fifo[c][fifo_pos[c]].used = 0;
-            if ( (++fifo_pos[c]) >= PULSGEN_FIFO_SIZE ) fifo_pos[c] = 0;
-
-            // have we a new task in the fifo?
-            if ( fifo[c][fifo_pos[c]].used ) // setup new task
-            {
-                task_setup(c,
-                    fifo[c][fifo_pos[c]].toggles_dir,
-                    fifo[c][fifo_pos[c]].toggles,
-                    fifo[c][fifo_pos[c]].pin_setup_time,
-                    fifo[c][fifo_pos[c]].pin_hold_time,
-                    fifo[c][fifo_pos[c]].start_delay);
-            }
-            else // disable channel
-            {
-                gen[c].task = 0;
-                if ( max_id && c == max_id ) --max_id;
-            }
+        ++gen[c].tasks_done;
 
-            continue;
-        }
-
-        // pin state is HIGH?
-        if ( GPIO_PIN_GET(gen[c].port, gen[c].pin_mask) ^ gen[c].pin_inverted )
+        // have we a new task in the fifo?
+        if ( fifo_head[c] != fifo_tail[c] ) // setup new task
         {
-            GPIO_PIN_CLEAR(gen[c].port, gen[c].pin_mask_not);
-            if ( gen[c].abort_on_setup ) abort(c);
-            else gen[c].todo_tick += (uint64_t)gen[c].setup_ticks;
+            struct pulsgen_fifo_item_t *item =
+                &fifo[c][fifo_head[c]++ & PULSGEN_FIFO_MASK];
+
+            task_setup(c,
+                item->toggles_dir,
+                item->toggles,
+                item->pin_setup_time,
+                item->pin_hold_time,
+                item->start_delay,
+                sched_tick);
         }
-        else // pin state is LOW
+        else // disable channel
         {
-            GPIO_PIN_SET(gen[c].port, gen[c].pin_mask);
-            if ( gen[c].abort_on_hold ) abort(c);
-            else gen[c].todo_tick += (uint64_t)gen[c].hold_ticks;
+            gen[c].task = 0;
+            return -1;
         }
 
-        // decrease pin toggles to do
-        --gen[c].task_toggles_todo;
+        *deadline = gen[c].todo_tick;
+        return 0;
+    }
 
-        // update total toggles value
-        gen[c].cnt += gen[c].task_toggles * (gen[c].toggles_dir ? -1 : 1);
+    // pin state is HIGH?
+    // (the pin is written by the gpio_port_flush() of the scheduler pass)
+    if ( GPIO_PIN_GET(pins[c].port, pins[c].pin_mask) ^ pins[c].pin_inverted )
+    {
+        GPIO_PIN_CLEAR_LATER(pins[c].port, pins[c].pin_mask, pins[c].pin_mask_not);
+        if ( gen[c].abort_on_setup ) abort(c);
+        else gen[c].todo_tick += gen[c].setup_ticks;
+    }
+    else // pin state is LOW
+    {
+        GPIO_PIN_SET_LATER(pins[c].port, pins[c].pin_mask, pins[c].pin_mask_not);
+        if ( gen[c].abort_on_hold ) abort(c);
+        else gen[c].todo_tick += gen[c].hold_ticks;
     }
 
-    // watchdog time is over?
-    if ( abort_all ) abort_all = 0; // reset abort flag
+    // decrease pin toggles to do
+    --gen[c].task_toggles_todo;
+
+    // update total toggles value
+    gen[c].cnt += gen[c].toggles_dir ? -1 : 1;
+
+    // aborted?
+    if ( !gen[c].task ) return -1;
+
+    *deadline = gen[c].todo_tick;
+    return 0;
+}
+
+
+
+
+// public methods
+
+/**
+ * @brief   module init
+ * @note    call this function only once before sched_module_init()
+ * @retval  none
+ */
+void pulsgen_module_init()
+{
+    uint8_t i = 0;
+
+    // add message handlers
+    for ( i = PULSGEN_MSG_PIN_SETUP; i < PULSGEN_MSG_CNT; i++ )
+    {
+        msg_recv_callback_add(i, (msg_recv_func_t) pulsgen_msg_recv);
+    }
+
+    // channels are processed by the scheduler
+    sched_func_set(SCHED_PULSGEN, sched_process);
 }
 
 
@@ -159,14 +185,14 @@ void pulsgen_pin_setup(uint8_t c, uint8_t port, uint8_t pin, uint8_t inverted)
 {
     gpio_pin_setup_for_output(port, pin);
 
-    gen[c].port = port;
-    gen[c].pin_mask = 1U << pin;
-    gen[c].pin_mask_not = ~(gen[c].pin_mask);
-    gen[c].pin_inverted = inverted ? gen[c].pin_mask : 0;
+    pins[c].port = port;
+    pins[c].pin_mask = 1U << pin;
+    pins[c].pin_mask_not = ~(pins[c].pin_mask);
+    pins[c].pin_inverted = inverted ? pins[c].pin_mask : 0;
 
     // set pin state
-    if ( gen[c].pin_inverted )  GPIO_PIN_SET    (port, gen[c].pin_mask);
-    else                        GPIO_PIN_CLEAR  (port, gen[c].pin_mask_not);
+    if ( pins[c].pin_inverted )  GPIO_PIN_SET    (port, pins[c].pin_mask);
+    else                        GPIO_PIN_CLEAR  (port, pins[c].pin_mask_not);
 }
 
 
@@ -182,9 +208,10 @@ void pulsgen_pin_setup(uint8_t c, uint8_t port, uint8_t pin, uint8_t inverted)
  * @param   pin_hold_time   pin state hold_time (in nanoseconds)
  * @param   start_delay     task start delay (in nanoseconds)
  *
- * @retval  none
+ * @retval   0 (task added)
+ * @retval  -1 (task not added)
  */
-void pulsgen_task_add
+int8_t pulsgen_task_add
 (
     uint32_t c,
     uint32_t toggles_dir,
@@ -194,35 +221,29 @@ void pulsgen_task_add
     uint32_t start_delay
 )
 {
-    uint8_t i, pos;
+    struct pulsgen_fifo_item_t *item;
 
-    // channel is busy?
-    if ( gen[c].task )
+    // channel is idle? - setup current task
+    if ( !gen[c].task )
     {
-        // find free fifo slot for the new task
-        for ( i = PULSGEN_FIFO_SIZE, pos = fifo_pos[c] + 1; i--; pos++ )
-        {
-            if ( pos >= PULSGEN_FIFO_SIZE ) pos = 0;
-            if ( fifo[c][pos].used ) continue;
-
-            fifo[c][pos].used = 1;
-            fifo[c][pos].toggles_dir = toggles_dir;
-            fifo[c][pos].toggles = toggles;
-            fifo[c][pos].pin_setup_time = pin_setup_time;
-            fifo[c][pos].pin_hold_time = pin_hold_time;
-            fifo[c][pos].start_delay = start_delay;
+        task_setup(c, toggles_dir, toggles, pin_setup_time, pin_hold_time, start_delay, TIMER_CNT_GET());
+        sched_add(SCHED_ID(SCHED_PULSGEN, c), gen[c].todo_tick);
+        return 0;
+    }
 
-            return;
-        }
+    // no free fifo items?
+    if ( (uint8_t)(fifo_tail[c] - fifo_head[c]) >= PULSGEN_FIFO_SIZE ) return -1;
 
-        return;
-    }
+    item = &fifo[c][fifo_tail[c] & PULSGEN_FIFO_MASK];
+    item->toggles_dir = toggles_dir;
+    item->toggles = toggles;
+    item->pin_setup_time = pin_setup_time;
+    item->pin_hold_time = pin_hold_time;
+    item->start_delay = start_delay;
 
-    // block current fifo item
-    fifo[c][fifo_pos[c]].used = 1;
+    ++fifo_tail[c];
 
-    // setup current task
-    task_setup(c, toggles_dir, toggles, pin_setup_time, pin_hold_time, start_delay);
+    return 0;
 }
 
 static void task_setup
@@ -232,11 +253,10 @@ static void task_setup
     uint32_t toggles,
     uint32_t pin_setup_time,
     uint32_t pin_hold_time,
-    uint32_t start_delay
+    uint32_t start_delay,
+    uint32_t tick
 )
 {
-    if ( c > max_id ) ++max_id;
-
     // set task data
     gen[c].task = 1;
     gen[c].task_infinite = toggles ? 0 : 1;
@@ -246,18 +266,15 @@ static void task_setup
     gen[c].abort_on_hold = 0;
     gen[c].abort_on_setup = 0;
 
-    gen[c].setup_ticks = (uint32_t) ( (uint64_t)pin_setup_time *
-        (uint64_t)TIMER_FREQUENCY_MHZ / (uint64_t)1000 );
-    gen[c].hold_ticks = (uint32_t) ( (uint64_t)pin_hold_time *
-        (uint64_t)TIMER_FREQUENCY_MHZ / (uint64_t)1000 );
+    gen[c].setup_ticks = NS_TO_TICKS(pin_setup_time);
+    gen[c].hold_ticks = NS_TO_TICKS(pin_hold_time);
 
     gen[c].todo_tick = tick;
 
     // if we need a delay before task start
     if ( start_delay )
     {
-        gen[c].todo_tick += (uint64_t)start_delay *
-            (uint64_t)TIMER_FREQUENCY_MHZ / (uint64_t)1000;
+        gen[c].todo_tick += NS_TO_TICKS(start_delay);
     }
 }
 
@@ -272,15 +289,15 @@ static void task_setup
 void pulsgen_abort(uint8_t c, uint8_t on_hold)
 {
     // pin state is HIGH?
-    if ( GPIO_PIN_GET(gen[c].port, gen[c].pin_mask) ^ gen[c].pin_inverted )
+    if ( GPIO_PIN_GET(pins[c].port, pins[c].pin_mask) ^ pins[c].pin_inverted )
     {
         // abort on pin hold?
-        if ( on_hold ) { abort(c); return; }
+        if ( on_hold ) { sched_remove(SCHED_ID(SCHED_PULSGEN, c)); abort(c); return; }
     }
     else // pin state is LOW
     {
         // abort on pin setup?
-        if ( !on_hold ) { abort(c); return; }
+        if ( !on_hold ) { sched_remove(SCHED_ID(SCHED_PULSGEN, c)); abort(c); return; }
     }
 
     // abort on pin hold?
@@ -291,16 +308,12 @@ void pulsgen_abort(uint8_t c, uint8_t on_hold)
 
 static void abort(uint8_t c)
 {
-    uint8_t i;
-
     gen[c].abort_on_hold = 0;
     gen[c].abort_on_setup = 0;
     gen[c].task = 0;
 
-    if ( max_id && c == max_id ) --max_id;
-
     // fifo cleanup
-    for ( i = PULSGEN_FIFO_SIZE; i--; ) fifo[c][i].used = 0;
+    fifo_head[c] = fifo_tail[c];
 }
 
 
@@ -391,10 +404,18 @@ void pulsgen_tasks_done_set(uint8_t c, uint32_t tasks)
  */
 void pulsgen_watchdog_setup(uint8_t enable, uint32_t time)
 {
-    if ( !enable ) { wd_todo_tick = 0; return; }
+    wd_enabled = enable ? 1 : 0;
+    if ( !enable ) return;
+
+    wd_ticks = NS_TO_TICKS(time);
+    wd_todo_tick = TIMER_CNT_GET() + wd_ticks;
 
-    wd_ticks = (uint64_t)time * (uint64_t)TIMER_FREQUENCY_MHZ / (uint64_t)1000;
-    wd_todo_tick = tick + wd_ticks;
+    // the watchdog is processed by the scheduler
+    if ( !wd_scheduled )
+    {
+        sched_add(SCHED_ID(SCHED_PULSGEN, SCHED_WATCHDOG_CH), wd_todo_tick);
+        wd_scheduled = 1;
+    }
 }
 
 
@@ -415,13 +436,11 @@ void pulsgen_watchdog_setup(uint8_t enable, uint32_t time)
  */
 int8_t volatile pulsgen_msg_recv(uint8_t type, uint8_t * msg, uint8_t length)
 {
-    static uint8_t i = 0;
-
     // any incoming message will update the watchdog wait time
-    if ( wd_todo_tick ) wd_todo_tick = tick + wd_ticks;
+    if ( wd_enabled ) wd_todo_tick = TIMER_CNT_GET() + wd_ticks;
 
     u32_10_t in = *((u32_10_t*) msg);
-    u32_10_t out = *((u32_10_t*) &msg_buf);
+    u32_10_t *out;
 
     switch (type)
     {
@@ -435,23 +454,27 @@ int8_t volatile pulsgen_msg_recv(uint8_t type, uint8_t * msg, uint8_t length)
             pulsgen_abort(in.v[0], in.v[1]);
             break;
         case PULSGEN_MSG_STATE_GET:
-            out.v[0] = pulsgen_state_get(in.v[0]);
-            msg_send(type, msg_buf, 4);
+            out = (u32_10_t*) msg_reserve();
+            out->v[0] = pulsgen_state_get(in.v[0]);
+            msg_commit(type, 4);
             break;
         case PULSGEN_MSG_TASK_TOGGLES_GET:
-            out.v[0] = pulsgen_task_toggles_get(in.v[0]);
-            msg_send(type, msg_buf, 4);
+            out = (u32_10_t*) msg_reserve();
+            out->v[0] = pulsgen_task_toggles_get(in.v[0]);
+            msg_commit(type, 4);
             break;
         case PULSGEN_MSG_CNT_GET:
-            out.v[0] = pulsgen_cnt_get(in.v[0]);
-            msg_send(type, msg_buf, 4);
+            out = (u32_10_t*) msg_reserve();
+            out->v[0] = pulsgen_cnt_get(in.v[0]);
+            msg_commit(type, 4);
             break;
         case PULSGEN_MSG_CNT_SET:
             pulsgen_cnt_set(in.v[0], (int32_t)in.v[1]);
             break;
         case PULSGEN_MSG_TASKS_DONE_GET:
-            out.v[0] = pulsgen_tasks_done_get(in.v[0]);
-            msg_send(type, msg_buf, 4);
+            out = (u32_10_t*) msg_reserve();
+            out->v[0] = pulsgen_tasks_done_get(in.v[0]);
+            msg_commit(type, 4);
             break;
         case PULSGEN_MSG_TASKS_DONE_SET:
             pulsgen_tasks_done_set(in.v[0], in.v[1]);
@@ -463,6 +486,11 @@ int8_t volatile pulsgen_msg_recv(uint8_t type, uint8_t * msg, uint8_t length)
         default: return -1;
     }
 
+#if TIMER_IRQ_MODE
+    // the message could change the next deadline
+    sched_irq_thread();
+#endif
+
     return 0;
 }
 
@@ -477,12 +505,14 @@ int8_t volatile pulsgen_msg_recv(uint8_t type, uint8_t * msg, uint8_t length)
     @code
         #include <stdint.h>
         #include "mod_gpio.h"
+        #include "mod_sched.h"
         #include "mod_pulsgen.h"
 
         int main(void)
         {
             // module init
             pulsgen_module_init();
+            sched_module_init();
 
             // use GPIO pin PA3 for the channel 0 output
             pulsgen_pin_setup(0, PA, 3, 0);
@@ -494,10 +524,8 @@ int8_t volatile pulsgen_msg_recv(uint8_t type, uint8_t * msg, uint8_t length)
             // main loop
             for(;;)
             {
-                // real update of channel states
-                pulsgen_module_base_thread();
-                // real update of pin states
-                gpio_module_base_thread();
+                // real update of channel and pin states
+                sched_module_base_thread();
             }
 
             return 0;
@@ -509,6 +537,7 @@ int8_t volatile pulsgen_msg_recv(uint8_t type, uint8_t * msg, uint8_t length)
     @code
         #include <stdint.h>
         #include "mod_gpio.h"
+        #include "mod_sched.h"
         #include "mod_pulsgen.h"
 
         #define STEP_CHANNEL 0
@@ -521,6 +550,7 @@ int8_t volatile pulsgen_msg_recv(uint8_t type, uint8_t * msg, uint8_t length)
 
             // module init
             pulsgen_module_init();
+            sched_module_init();
 
             // use GPIO pin PA3 for the STEP output on the channel 0
             pulsgen_pin_setup(STEP_CHANNEL, PA, 3, 0);
@@ -552,10 +582,8 @@ int8_t volatile pulsgen_msg_recv(uint8_t type, uint8_t * msg, uint8_t length)
                     }
                 }
 
-                // real update of channel states
-                pulsgen_module_base_thread();
-                // real update of pin states
-                gpio_module_base_thread();
+                // real update of channel and pin states
+                sched_module_base_thread();
             }
 
             return 0;
@@ -17,41 +17,51 @@
 
 
 
+#ifndef PULSGEN_MODULE
+#define PULSGEN_MODULE      1   ///< 0 = the module isn't used by the firmware
+#endif
+#ifndef PULSGEN_CH_CNT
 #define PULSGEN_CH_CNT      32  ///< maximum number of pulse generator channels
-#define PULSGEN_FIFO_SIZE   4   ///< size of channel's fifo buffer
+#endif
+#ifndef PULSGEN_FIFO_SIZE
+#define PULSGEN_FIFO_SIZE   8   ///< size of channel's fifo buffer (power of 2, 2..128)
+#endif
+#define PULSGEN_FIFO_MASK   (PULSGEN_FIFO_SIZE - 1)
 
 
 
 
-/// a channel parameters
+/// a channel state, used by every pin toggle
 struct pulsgen_ch_t
 {
-    uint32_t    port;               // GPIO port number
-    uint32_t    pin_mask;           // GPIO pin mask
-    uint32_t    pin_mask_not;       // GPIO pin ~mask
-    uint32_t    pin_inverted;       // same as `pin_mask` or 0
-
     uint8_t     task;               // 0 = "channel disabled"
     uint8_t     task_infinite;      // 0 = "make task_toggles and disable the channel"
-    uint32_t    task_toggles;       // pin toggles for this task
-    uint32_t    task_toggles_todo;  // pin toggles left to do for this task
-
-    uint32_t    tasks_done;         // total number of tasks done
+    uint8_t     abort_on_setup;
+    uint8_t     abort_on_hold;
     uint8_t     toggles_dir;        // 0 = cnt++, !0 = cnt--
-    int32_t     cnt;                // total number of pin toggles
 
+    uint32_t    todo_tick;          // timestamp (lower 32 bits of CPU ticks) to change pin state
     uint32_t    setup_ticks;        // number of CPU ticks to prepare pin toggle
     uint32_t    hold_ticks;         // number of CPU ticks to hold pin state
 
-    uint8_t     abort_on_setup;
-    uint8_t     abort_on_hold;
+    uint32_t    task_toggles;       // pin toggles for this task
+    uint32_t    task_toggles_todo;  // pin toggles left to do for this task
+
+    int32_t     cnt;                // total number of pin toggles
+    uint32_t    tasks_done;         // total number of tasks done
+};
 
-    uint64_t    todo_tick;          // timestamp (in CPU ticks) to change pin state
+/// a channel pin setup
+struct pulsgen_pin_t
+{
+    uint32_t    port;               // GPIO port number
+    uint32_t    pin_mask;           // GPIO pin mask
+    uint32_t    pin_mask_not;       // GPIO pin ~mask
+    uint32_t    pin_inverted;       // same as `pin_mask` or 0
 };
 
 struct pulsgen_fifo_item_t
 {
-    uint8_t used;
     uint8_t toggles_dir;
     uint32_t toggles;
     uint32_t pin_setup_time;
@@ -64,7 +74,7 @@ struct pulsgen_fifo_item_t
 /// messages types
 enum
 {
-    PULSGEN_MSG_PIN_SETUP = 0x20,
+    PULSGEN_MSG_PIN_SETUP = 0x40,
     PULSGEN_MSG_TASK_ADD,
     PULSGEN_MSG_ABORT,
     PULSGEN_MSG_STATE_GET,
@@ -77,18 +87,14 @@ enum
     PULSGEN_MSG_CNT
 };
 
-/// the message data sizes
-#define PULSGEN_MSG_BUF_LEN MSG_LEN
-
 
 
 
 // export public methods
 
 void pulsgen_module_init();
-void pulsgen_module_base_thread();
 void pulsgen_pin_setup(uint8_t c, uint8_t port, uint8_t pin, uint8_t inverted);
-void pulsgen_task_add(uint32_t c, uint32_t toggles_dir, uint32_t toggles, uint32_t pin_setup_time, uint32_t pin_hold_time, uint32_t start_delay);
+int8_t pulsgen_task_add(uint32_t c, uint32_t toggles_dir, uint32_t toggles, uint32_t pin_setup_time, uint32_t pin_hold_time, uint32_t start_delay);
 void pulsgen_abort(uint8_t c, uint8_t on_hold);
 uint8_t pulsgen_state_get(uint8_t c);
 uint32_t pulsgen_task_toggles_get(uint8_t c);
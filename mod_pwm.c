@@ -0,0 +1,289 @@
+/**
+ * @file    mod_pwm.c
+ *
+ * @brief   hardware PWM module
+ *
+ * This module implements an API to the H3 PWM and R_PWM blocks,
+ * so fixed frequency outputs don't use the software pulse generators
+ */
+
+#include "io.h"
+#include "mod_gpio.h"
+#include "mod_pwm.h"
+
+
+
+
+// private vars
+
+static struct pwm_ch_t gen[PWM_CH_CNT] = {{0}};
+
+/// a channel hardware
+static const struct
+{
+    uint32_t base;
+    uint8_t port;
+    uint8_t pin;
+    uint8_t func;
+}
+hw[PWM_CH_CNT] =
+{
+    { PWM_BASE,     PA, 5,  GPIO_FUNC_BANK_A_PWM0 },
+    { PWM_R_BASE,   PL, 10, GPIO_FUNC_BANK_L_S_PWM }
+};
+
+/// OSC24M dividers and their prescaler codes, from the lowest divider
+static const uint32_t prescal_div[] = { 1, 120, 180, 240, 360, 480, 12000, 24000, 36000, 48000, 72000 };
+static const uint8_t prescal_code[] = { 15, 0, 1, 2, 3, 4, 8, 9, 10, 11, 12 };
+
+#define PRESCAL_CNT (sizeof(prescal_div) / sizeof(prescal_div[0]))
+
+// 24 MHz is 3 cycles per 125 ns, the conversions are exact with 32-bit math
+typedef char pwm_clk_check[(PWM_CLK_FREQ == 24000000) ? 1 : -1];
+
+
+
+// private functions
+
+static int8_t wait_ready(uint8_t c)
+{
+    uint32_t i;
+
+    for ( i = PWM_RDY_WAIT; i--; )
+    {
+        if ( !(readl(PWM_CTRL_REG(hw[c].base)) & PWM_CTRL_RDY) ) return 0;
+    }
+
+    return -1;
+}
+
+static uint32_t ns_to_cycles(uint32_t ns)
+{
+    return ns / 125 * 3 + ns % 125 * 3 / 125;
+}
+
+static uint32_t cycles_to_ns(uint32_t cycles)
+{
+    return cycles / 3 * 125 + cycles % 3 * 125 / 3;
+}
+
+
+
+
+// public methods
+
+/**
+ * @brief   module init
+ * @note    call this function only once
+ * @retval  none
+ */
+void pwm_module_init()
+{
+    uint8_t i = 0;
+
+    // add message handlers
+    for ( i = PWM_MSG_PIN_SETUP; i < PWM_MSG_CNT; i++ )
+    {
+        msg_recv_callback_add(i, (msg_recv_func_t) pwm_msg_recv);
+    }
+}
+
+
+
+
+/**
+ * @brief   switch the channel pin to the PWM function
+ * @param   c           channel id
+ * @param   inverted    invert output state?
+ * @retval   0 (done)
+ * @retval  -1 (wrong channel id)
+ */
+int8_t pwm_pin_setup(uint8_t c, uint8_t inverted)
+{
+    if ( c >= PWM_CH_CNT ) return -1;
+
+    gen[c].inverted = inverted ? 1 : 0;
+
+    gpio_pin_setup_for_func(hw[c].port, hw[c].pin, hw[c].func);
+
+    return 0;
+}
+
+/**
+ * @brief   start the infinite PWM signal for the selected channel
+ *
+ * @param   c               channel id
+ * @param   period          PWM period (in nanoseconds)
+ * @param   pin_high_time   pin HIGH state time (in nanoseconds)
+ *
+ * @note    with the 24 MHz clock the period resolution is about 42 ns,
+ *          longer periods use a prescaler, use pwm_period_get() to get the real period
+ *
+ * @retval   0 (PWM started)
+ * @retval  -1 (wrong channel id or period)
+ */
+int8_t pwm_task_add(uint8_t c, uint32_t period, uint32_t pin_high_time)
+{
+    uint32_t cycles, high_cycles, ctrl;
+    uint8_t p;
+
+    if ( c >= PWM_CH_CNT ) return -1;
+
+    cycles = ns_to_cycles(period);
+    high_cycles = ns_to_cycles(pin_high_time);
+    if ( high_cycles > cycles ) high_cycles = cycles;
+    if ( cycles < 2 ) return -1;
+
+    // find the lowest divider for this period
+    for ( p = 0; p < PRESCAL_CNT && (cycles / prescal_div[p]) > PWM_CYCLES_MAX; p++ );
+    if ( p >= PRESCAL_CNT ) return -1;
+
+    cycles /= prescal_div[p];
+    high_cycles /= prescal_div[p];
+    if ( cycles < 2 ) cycles = 2;
+
+    // prescaler can be changed when the clock is off
+    ctrl = readl(PWM_CTRL_REG(hw[c].base));
+    ctrl &= ~(PWM_CTRL_CLK_GATING | PWM_CTRL_ACT_HIGH);
+    writel(ctrl, PWM_CTRL_REG(hw[c].base));
+    SET_BITS_AT(ctrl, PWM_CTRL_PRESCAL_BITS, 0, prescal_code[p]);
+    if ( !gen[c].inverted ) ctrl |= PWM_CTRL_ACT_HIGH;
+    writel(ctrl, PWM_CTRL_REG(hw[c].base));
+
+    if ( wait_ready(c) ) return -1;
+    writel(((cycles - 1) << 16) | high_cycles, PWM_PERIOD_REG(hw[c].base));
+
+    ctrl |= PWM_CTRL_EN | PWM_CTRL_CLK_GATING;
+    writel(ctrl, PWM_CTRL_REG(hw[c].base));
+
+    gen[c].enabled = 1;
+    gen[c].period = cycles_to_ns(cycles * prescal_div[p]);
+    gen[c].pin_high_time = cycles_to_ns(high_cycles * prescal_div[p]);
+
+    return 0;
+}
+
+/**
+ * @brief   stop the PWM signal for the selected channel
+ * @param   c   channel id
+ * @retval  none
+ */
+void pwm_abort(uint8_t c)
+{
+    if ( c >= PWM_CH_CNT ) return;
+
+    writel(readl(PWM_CTRL_REG(hw[c].base)) & ~(PWM_CTRL_EN | PWM_CTRL_CLK_GATING),
+        PWM_CTRL_REG(hw[c].base));
+
+    gen[c].enabled = 0;
+}
+
+
+
+
+/**
+ * @brief   get the channel state
+ * @param   c   channel id
+ * @retval  0 (channel disabled)
+ * @retval  1 (channel enabled)
+ */
+uint8_t pwm_state_get(uint8_t c)
+{
+    return c < PWM_CH_CNT ? gen[c].enabled : 0;
+}
+
+/**
+ * @brief   get the real PWM period
+ * @param   c   channel id
+ * @retval  0..UINT32_MAX (in nanoseconds)
+ */
+uint32_t pwm_period_get(uint8_t c)
+{
+    return c < PWM_CH_CNT ? gen[c].period : 0;
+}
+
+
+
+
+/**
+ * @brief   "message received" callback
+ *
+ * @note    this function will be called automatically
+ *          when a new message will arrive for this module.
+ *
+ * @param   type    user defined message type (0..0xFF)
+ * @param   msg     pointer to the message buffer
+ * @param   length  the length of a message (0 .. MSG_LEN)
+ *
+ * @retval   0 (message read)
+ * @retval  -1 (message not read)
+ */
+int8_t volatile pwm_msg_recv(uint8_t type, uint8_t * msg, uint8_t length)
+{
+    u32_10_t *in = (u32_10_t*) msg;
+    u32_10_t *out;
+
+    switch (type)
+    {
+        case PWM_MSG_PIN_SETUP:
+            pwm_pin_setup(in->v[0], in->v[1]);
+            break;
+        case PWM_MSG_TASK_ADD:
+            out = (u32_10_t*) msg_reserve();
+            out->v[0] = (uint32_t) pwm_task_add(in->v[0], in->v[1], in->v[2]);
+            msg_commit(type, 4);
+            break;
+        case PWM_MSG_ABORT:
+            pwm_abort(in->v[0]);
+            break;
+        case PWM_MSG_STATE_GET:
+            out = (u32_10_t*) msg_reserve();
+            out->v[0] = pwm_state_get(in->v[0]);
+            msg_commit(type, 4);
+            break;
+        case PWM_MSG_PERIOD_GET:
+            out = (u32_10_t*) msg_reserve();
+            out->v[0] = pwm_period_get(in->v[0]);
+            out->v[1] = in->v[0] < PWM_CH_CNT ? gen[in->v[0]].pin_high_time : 0;
+            msg_commit(type, 2*4);
+            break;
+
+        default: return -1;
+    }
+
+    return 0;
+}
+
+
+
+
+/**
+    @example mod_pwm.c
+
+    <b>Usage example 1</b>: spindle speed signal on the PA5 pin
+
+    @code
+        #include <stdint.h>
+        #include "mod_pwm.h"
+
+        int main(void)
+        {
+            // module init
+            pwm_module_init();
+
+            // use the PA5 pin for the channel 0 output
+            pwm_pin_setup(0, 0);
+
+            // PWM frequency = 1 kHz, duty cycle = 25%
+            pwm_task_add(0, 1000000, 250000);
+
+            // main loop
+            for(;;)
+            {
+                // the signal doesn't need any CPU time
+            }
+
+            return 0;
+        }
+    @endcode
+*/
@@ -0,0 +1,83 @@
+/**
+ * @file    mod_pwm.h
+ *
+ * @brief   hardware PWM module header
+ *
+ * This module implements an API to the H3 PWM and R_PWM blocks,
+ * so fixed frequency outputs don't use the software pulse generators
+ */
+
+#ifndef _MOD_PWM_H
+#define _MOD_PWM_H
+
+#include <stdint.h>
+#include "mod_msg.h"
+
+
+
+
+#ifndef PWM_MODULE
+#define PWM_MODULE          1   ///< 0 = the module isn't used by the firmware
+#endif
+
+#define PWM_CH_CNT          2   ///< channel 0 = PWM0 (PA5), channel 1 = R_PWM (PL10)
+
+#define PWM_BASE            0x01c21400 ///< PWM registers block start address
+#define PWM_R_BASE          0x01f03800 ///< R_PWM registers block start address
+
+#define PWM_CTRL_REG(BASE)  ((BASE) + 0x00)
+#define PWM_PERIOD_REG(BASE) ((BASE) + 0x04)
+
+#define PWM_CTRL_PRESCAL_BITS   4
+#define PWM_CTRL_EN             BIT(4)
+#define PWM_CTRL_ACT_HIGH       BIT(5)
+#define PWM_CTRL_CLK_GATING     BIT(6)
+#define PWM_CTRL_RDY            BIT(28) ///< the period register is busy
+
+#define PWM_CLK_FREQ        24000000 ///< OSC24M, Hz
+#define PWM_CYCLES_MAX      65536
+#define PWM_RDY_WAIT        10000 ///< max number of the period register checks
+
+
+
+
+/// a channel state
+struct pwm_ch_t
+{
+    uint8_t     enabled;
+    uint8_t     inverted;
+    uint32_t    period;             // real PWM period (in nanoseconds)
+    uint32_t    pin_high_time;      // real pin HIGH time (in nanoseconds)
+};
+
+/// messages types
+enum
+{
+    PWM_MSG_PIN_SETUP = 0x70,
+    PWM_MSG_TASK_ADD,
+    PWM_MSG_ABORT,
+    PWM_MSG_STATE_GET,
+    PWM_MSG_PERIOD_GET,
+    PWM_MSG_CNT
+};
+
+
+
+
+// export public methods
+
+void pwm_module_init();
+
+int8_t pwm_pin_setup(uint8_t c, uint8_t inverted);
+int8_t pwm_task_add(uint8_t c, uint32_t period, uint32_t pin_high_time);
+void pwm_abort(uint8_t c);
+
+uint8_t pwm_state_get(uint8_t c);
+uint32_t pwm_period_get(uint8_t c);
+
+int8_t volatile pwm_msg_recv(uint8_t type, uint8_t * msg, uint8_t length);
+
+
+
+
+#endif
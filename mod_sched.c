@@ -0,0 +1,213 @@
+/**
+ * @file    mod_sched.c
+ *
+ * @brief   channels scheduler module
+ *
+ * This module implements a binary min-heap of channel deadlines,
+ * so the next channel to process is always at the top of the heap.
+ * All pulse generator modules share this scheduler
+ */
+
+#include "mod_gpio.h"
+#include "mod_sched.h"
+#include "mod_perf.h"
+
+
+
+
+// public vars
+
+sched_item_t sched_heap[SCHED_SIZE] SYS_HOT_BSS = {{0}}; // heap of channel deadlines
+uint8_t sched_cnt = 0; // number of scheduled channels
+uint32_t sched_tick = 0; // CPU tick of the current base thread pass
+
+
+
+
+// private vars
+
+static sched_func_t func[SCHED_OWNERS_CNT] = {0}; // channel processing functions
+static uint32_t epoch_tick = 0;
+
+
+
+
+// private functions
+
+SYS_HOT static void place(uint8_t i, sched_item_t item)
+{
+    uint8_t parent, child, moved = 0;
+
+    // move the item up to its place
+    for ( ; i; i = parent, moved = 1 )
+    {
+        parent = (i - 1) >> 1;
+        if ( !SCHED_BEFORE(item.tick, sched_heap[parent].tick) ) break;
+        sched_heap[i] = sched_heap[parent];
+    }
+
+    // move the item down to its place
+    for ( ; !moved && (child = 2*i + 1) < sched_cnt; i = child )
+    {
+        if ( (child + 1) < sched_cnt &&
+             SCHED_BEFORE(sched_heap[child + 1].tick, sched_heap[child].tick) ) child++;
+        if ( !SCHED_BEFORE(sched_heap[child].tick, item.tick) ) break;
+        sched_heap[i] = sched_heap[child];
+    }
+
+    sched_heap[i] = item;
+}
+
+
+
+
+// public methods
+
+/**
+ * @brief   module init
+ * @note    call this function after all pulse generator modules init
+ * @retval  none
+ */
+void sched_module_init()
+{
+    // start sys timer
+    TIMER_START();
+
+#if TIMER_IRQ_MODE
+    // channels will be processed by the tick timer interrupt
+    timer_irq_callback_set(sched_irq_thread);
+    sched_irq_thread();
+    TIMER_IRQ_UNLOCK();
+#endif
+}
+
+/**
+ * @brief   module base thread
+ * @note    call this function in the main loop (if TIMER_IRQ_MODE == 0)
+ * @retval  none
+ */
+SYS_HOT void sched_module_base_thread()
+{
+    static uint8_t n, i, id, due[SCHED_SIZE];
+    static uint32_t deadline;
+
+    // get current CPU tick, the same for all channels of this pass
+    sched_tick = TIMER_CNT_GET();
+
+    // keep the 64-bit timer value up to date for other modules
+    if ( TIMER_TICK_DUE(epoch_tick, sched_tick) )
+    {
+        timer_cnt_get_64();
+        epoch_tick = sched_tick + (1U << 30);
+    }
+
+    // it's not a time for all channels?
+    if ( !SCHED_DUE(sched_tick) ) return;
+
+    // get all channels which time is come
+    for ( n = 0; SCHED_DUE(sched_tick) && n < SCHED_SIZE; ) due[n++] = sched_pop();
+
+    // process the channels and put them back to the scheduler
+    for ( i = 0; i < n; i++ )
+    {
+        id = due[i];
+        if ( !func[id >> SCHED_CH_BITS] ) continue;
+        if ( !func[id >> SCHED_CH_BITS](id & SCHED_WATCHDOG_CH, &deadline) ) sched_add(id, deadline);
+    }
+
+    // real update of all changed ports
+    gpio_port_flush();
+}
+
+#if TIMER_IRQ_MODE
+/**
+ * @brief   process all due channels and request the next tick timer interrupt
+ * @note    call this function after any change of the scheduled deadlines
+ * @retval  none
+ */
+SYS_HOT void sched_irq_thread()
+{
+    uint32_t next;
+
+    for(;;)
+    {
+        PERF_CALL(PERF_THREAD_SCHED, sched_module_base_thread());
+
+        // wake up at least every TIMER_IRQ_MAX_TICKS to track the timer overflows
+        next = sched_cnt ? sched_heap[0].tick : sched_tick + TIMER_IRQ_MAX_TICKS;
+
+        // the next deadline is too close? - process it right now
+        if ( !timer_irq_setup(next) ) break;
+    }
+}
+#endif
+
+
+
+
+/**
+ * @brief   set the channel processing function of the owner
+ * @param   owner   SCHED_STEPGEN..SCHED_OWNERS_CNT-1
+ * @param   f       pointer to the function
+ * @retval  none
+ */
+void sched_func_set(uint8_t owner, sched_func_t f)
+{
+    func[owner] = f;
+}
+
+/**
+ * @brief   add a channel to the scheduler
+ *
+ * @note    every channel must be added only once,
+ *          use sched_pop() or sched_remove() to get it back from the scheduler
+ *
+ * @param   id      scheduler id, SCHED_ID(owner, channel)
+ * @param   tick    channel deadline (lower 32 bits of CPU ticks)
+ *
+ * @retval  none
+ */
+void sched_add(uint8_t id, uint32_t tick)
+{
+    sched_item_t item = { tick, id };
+
+    // no free space?
+    if ( sched_cnt >= SCHED_SIZE ) return;
+
+    place(sched_cnt++, item);
+}
+
+/**
+ * @brief   remove a channel from the scheduler
+ * @param   id      scheduler id, SCHED_ID(owner, channel)
+ * @retval  none
+ */
+void sched_remove(uint8_t id)
+{
+    uint8_t i;
+
+    for ( i = 0; i < sched_cnt && sched_heap[i].id != id; i++ );
+
+    // not scheduled?
+    if ( i >= sched_cnt ) return;
+
+    // put the last item to the free place
+    if ( i < --sched_cnt ) place(i, sched_heap[sched_cnt]);
+}
+
+/**
+ * @brief   remove the channel with the lowest deadline from the scheduler
+ * @note    use SCHED_DUE() to check for a channel before this call
+ * @retval  scheduler id
+ */
+uint8_t sched_pop()
+{
+    uint8_t id = sched_heap[0].id;
+
+    // empty heap?
+    if ( !sched_cnt ) return id;
+
+    if ( --sched_cnt ) place(0, sched_heap[sched_cnt]);
+
+    return id;
+}
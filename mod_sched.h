@@ -0,0 +1,94 @@
+/**
+ * @file    mod_sched.h
+ *
+ * @brief   channels scheduler module header
+ *
+ * This module implements a binary min-heap of channel deadlines,
+ * so the next channel to process is always at the top of the heap.
+ * All pulse generator modules share this scheduler
+ */
+
+#ifndef _MOD_SCHED_H
+#define _MOD_SCHED_H
+
+#include <stdint.h>
+#include "mod_timer.h"
+
+
+
+
+#ifndef SCHED_SIZE
+#define SCHED_SIZE  64  ///< maximum number of scheduled channels
+#endif
+
+#define SCHED_CH_BITS       6   ///< channel id bits of the scheduler id
+#define SCHED_WATCHDOG_CH   ((1U << SCHED_CH_BITS) - 1) ///< channel id of the owner's watchdog
+
+
+
+
+/// a heap item
+typedef struct
+{
+    uint32_t    tick;   // channel deadline (lower 32 bits of CPU ticks)
+    uint8_t     id;     // scheduler id
+
+} sched_item_t;
+
+/// owners of the scheduled channels
+enum
+{
+    SCHED_STEPGEN,
+    SCHED_PULSGEN,
+    SCHED_WAVE,
+    SCHED_OWNERS_CNT
+};
+
+/// channel processing function, returns 0 to schedule the channel again at the *tick
+typedef int8_t (*sched_func_t)(uint8_t c, uint32_t * tick);
+
+
+
+
+// public methods as macros
+
+/// scheduler id of the owner's channel
+#define SCHED_ID(OWNER, C) \
+    ( ((OWNER) << SCHED_CH_BITS) | (C) )
+
+/// is the deadline A before the deadline B? (deadlines must be closer than 2^31 ticks)
+#define SCHED_BEFORE(A, B) \
+    ( (int32_t)((A) - (B)) < 0 )
+
+/// have we a channel which deadline is less or equal to the TICK?
+#define SCHED_DUE(TICK) \
+    ( sched_cnt && !SCHED_BEFORE((TICK), sched_heap[0].tick) )
+
+
+
+
+// export public vars
+
+extern sched_item_t sched_heap[SCHED_SIZE];
+extern uint8_t sched_cnt;
+extern uint32_t sched_tick;
+
+
+
+
+// export public methods
+
+void sched_module_init();
+void sched_module_base_thread();
+void sched_func_set(uint8_t owner, sched_func_t func);
+void sched_add(uint8_t id, uint32_t tick);
+void sched_remove(uint8_t id);
+uint8_t sched_pop();
+#if TIMER_IRQ_MODE
+void sched_irq_thread();
+#endif
+
+
+
+
+#endif
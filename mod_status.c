@@ -0,0 +1,192 @@
+/**
+ * @file    mod_status.c
+ *
+ * @brief   channels status snapshot module
+ *
+ * This module periodically publishes positions and counts of all channels
+ * to the shared memory, so the ARM can read them without any messages
+ */
+
+#include <string.h>
+#include "io.h"
+#include "mod_timer.h"
+#include "mod_status.h"
+
+
+
+
+// private vars
+
+static volatile struct status_t * st = (struct status_t *) STATUS_ADDR;
+
+static uint8_t enabled = 0;
+static uint32_t period_ticks = 0;
+static uint32_t todo_tick = 0;
+
+// the snapshot must fit its area
+typedef char status_size_check[(sizeof(struct status_t) <= STATUS_SIZE) ? 1 : -1];
+
+
+
+
+// public methods
+
+/**
+ * @brief   module init
+ * @note    call this function only once before status_module_base_thread()
+ * @retval  none
+ */
+void status_module_init()
+{
+    uint8_t i = 0;
+
+    memset((uint8_t*)STATUS_ADDR, 0, STATUS_SIZE);
+
+    status_setup(0, STATUS_PERIOD);
+
+    // add message handlers
+    for ( i = STATUS_MSG_SETUP; i < STATUS_MSG_CNT; i++ )
+    {
+        msg_recv_callback_add(i, (msg_recv_func_t) status_msg_recv);
+    }
+}
+
+/**
+ * @brief   module base thread
+ * @note    call this function anywhere in the main loop
+ * @retval  none
+ */
+SYS_HOT void status_module_base_thread()
+{
+    if ( !enabled ) return;
+    if ( (int32_t)(TIMER_CNT_GET() - todo_tick) < 0 ) return;
+
+    todo_tick += period_ticks;
+    status_update();
+}
+
+
+
+
+/**
+ * @brief   enable/disable periodic snapshot updates
+ * @param   enable      0 = disable updates, other values - enable updates
+ * @param   period      update period (in nanoseconds)
+ * @retval  none
+ */
+void status_setup(uint8_t enable, uint32_t period)
+{
+    enabled = enable ? 1 : 0;
+    period_ticks = NS_TO_TICKS(period);
+    todo_tick = TIMER_CNT_GET();
+}
+
+/**
+ * @brief   update the snapshot right now
+ * @retval  none
+ */
+void status_update()
+{
+    uint64_t tick;
+    uint8_t c;
+
+    // all channels must be sampled at the same time
+    TIMER_IRQ_LOCK();
+
+    // the ARM must not use the snapshot from now
+    st->seq++;
+    msync();
+
+    tick = timer_cnt_get_64();
+    st->tick_lo = (uint32_t) tick;
+    st->tick_hi = (uint32_t) (tick >> 32);
+
+    for ( c = STEPGEN_CH_CNT; c--; )
+    {
+        st->stepgen_pos[c] = stepgen_pos_get(c);
+        st->stepgen_fifo[c] = stepgen_fifo_fill_get(c);
+    }
+
+#if PULSGEN_MODULE
+    for ( c = PULSGEN_CH_CNT; c--; )
+    {
+        st->pulsgen_cnt[c] = pulsgen_cnt_get(c);
+        st->pulsgen_tasks_done[c] = pulsgen_tasks_done_get(c);
+    }
+#endif
+
+#if ENCODER_MODULE
+    for ( c = ENCODER_CH_CNT; c--; )
+    {
+        st->encoder_counts[c] = encoder_counts_get(c);
+    }
+#endif
+
+    // the snapshot is ready
+    msync();
+    st->seq++;
+
+    TIMER_IRQ_UNLOCK();
+}
+
+
+
+
+/**
+ * @brief   "message received" callback
+ *
+ * @note    this function will be called automatically
+ *          when a new message will arrive for this module.
+ *
+ * @param   type    user defined message type (0..0xFF)
+ * @param   msg     pointer to the message buffer
+ * @param   length  the length of a message (0 .. MSG_LEN)
+ *
+ * @retval   0 (message read)
+ * @retval  -1 (message not read)
+ */
+int8_t volatile status_msg_recv(uint8_t type, uint8_t * msg, uint8_t length)
+{
+    u32_10_t *in = (u32_10_t*) msg;
+
+    switch (type)
+    {
+        case STATUS_MSG_SETUP:
+            status_setup(in->v[0], in->v[1]);
+            break;
+
+        default: return -1;
+    }
+
+    return 0;
+}
+
+
+
+
+/**
+    @example mod_status.c
+
+    @code
+        #include <stdint.h>
+        #include "mod_status.h"
+
+        int main(void)
+        {
+            // module init
+            status_module_init();
+
+            // update the snapshot every 500 us
+            status_setup(1, 500000);
+
+            // main loop
+            for(;;)
+            {
+                // real update of the snapshot
+                status_module_base_thread();
+            }
+
+            return 0;
+        }
+    @endcode
+*/
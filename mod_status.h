@@ -0,0 +1,79 @@
+/**
+ * @file    mod_status.h
+ *
+ * @brief   channels status snapshot module header
+ *
+ * This module periodically publishes positions and counts of all channels
+ * to the shared memory, so the ARM can read them without any messages
+ */
+
+#ifndef _MOD_STATUS_H
+#define _MOD_STATUS_H
+
+#include <stdint.h>
+#include "mod_msg.h"
+#include "mod_stepgen.h"
+#include "mod_pulsgen.h"
+#include "mod_encoder.h"
+
+
+
+
+#ifndef STATUS_MODULE
+#define STATUS_MODULE           1 ///< 0 = the module isn't used by the firmware
+#endif
+
+#define STATUS_ADDR             (ARISC_CONF_ADDR + MSG_RING_CTRL_SIZE) ///< snapshot address
+#define STATUS_SIZE             512 ///< snapshot area size
+
+#ifndef STATUS_PERIOD
+/// default snapshot update period (in nanoseconds)
+#define STATUS_PERIOD           1000000
+#endif
+
+
+
+
+/**
+ * @brief   the snapshot structure
+ *
+ * @note    the ARM must read `seq` then copy the snapshot and read `seq` again,
+ *          copy is consistent if both `seq` values are equal and even
+ */
+struct status_t
+{
+    uint32_t    seq; // odd = update in progress
+    uint32_t    tick_lo; // snapshot timestamp
+    uint32_t    tick_hi;
+
+    int32_t     stepgen_pos[STEPGEN_CH_CNT];
+    uint8_t     stepgen_fifo[STEPGEN_CH_CNT]; // number of used fifo slots
+
+    int32_t     pulsgen_cnt[PULSGEN_CH_CNT];
+    uint32_t    pulsgen_tasks_done[PULSGEN_CH_CNT];
+
+    int32_t     encoder_counts[ENCODER_CH_CNT];
+};
+
+/// messages types
+enum
+{
+    STATUS_MSG_SETUP = 0x50,
+    STATUS_MSG_CNT
+};
+
+
+
+
+// export public methods
+
+void status_module_init();
+void status_module_base_thread();
+void status_setup(uint8_t enable, uint32_t period);
+void status_update();
+int8_t volatile status_msg_recv(uint8_t type, uint8_t * msg, uint8_t length);
+
+
+
+
+#endif
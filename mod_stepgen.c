@@ -6,110 +6,481 @@
 
 #include "mod_timer.h"
 #include "mod_gpio.h"
+#include "mod_sched.h"
 #include "mod_stepgen.h"
+#include "mod_perf.h"
 
 
 
 
-#define SG gen[c]               // current channel
-#define SLOT SG.task_slot       // current task slot
-#define TASK SG.tasks[SLOT]     // current task
+#define SG gen[c]                                       // current channel
+#define PIN pins[c]                                     // current channel pins
+#define START starts[c]                                 // current channel task start
+#define RAMP ramps[c]                                   // current channel RAMP task
+#define LOOP loops[c]                                   // current channel closed loop
+#define SLOT (SG.fifo_head & STEPGEN_FIFO_MASK)         // current task slot
+#define TASK fifo[c][SLOT]                              // current task
+#define BUSY (SG.fifo_head != SG.fifo_tail)             // channel have a task?
+#define FULL ((uint8_t)(SG.fifo_tail - SG.fifo_head) >= STEPGEN_FIFO_SIZE)
+#define IS_DIR (TASK.type == STEPGEN_TASK_DIR)           // current task is a DIR task?
+
+// inline DIR change states
+#define DIR_NONE    0   // nothing to do
+#define DIR_HOLD    1   // DIR change must wait until dir_tick
+#define DIR_SETUP   2   // DIR changed at dir_tick, the next step must wait the setup time
 
 
 
 
 // private vars
 
-static uint8_t max_id = 0; // uses to speedup idle channels processing
-static stepgen_ch_t gen[STEPGEN_CH_CNT] = {0}; // array of channels data
-static uint8_t msg_buf[STEPGEN_MSG_BUF_LEN] = {0}; // message buffer
-static uint64_t tick = 0, wd_ticks = 0, wd_todo_tick = 0;
+// hot channels state first, setup and fifo data separately
+static stepgen_ch_t gen[STEPGEN_CH_CNT] SYS_HOT_BSS = {{0}}; // array of channels data
+static stepgen_pin_t pins[STEPGEN_CH_CNT] = {{{0}}}; // array of channels pins
+static stepgen_start_t starts[STEPGEN_CH_CNT] = {{0}}; // array of channels task starts
+static stepgen_ramp_t ramps[STEPGEN_CH_CNT] = {{0}}; // array of channels RAMP tasks
+static stepgen_fifo_slot_t fifo[STEPGEN_CH_CNT][STEPGEN_FIFO_SIZE] = {{{0}}}; // channels tasks
+#if STEPGEN_LOOP
+static stepgen_loop_t loops[STEPGEN_CH_CNT] = {{0}}; // array of channels closed loops
+static uint8_t loops_cnt = 0; // number of enabled closed loops
+#endif
+#if STEPGEN_WATCHDOG
+static uint32_t wd_ticks = 0, wd_todo_tick = 0;
+static uint8_t wd_enabled = 0, wd_scheduled = 0;
+#endif
+
+// the hot state of all channels must stay within a few cache lines
+typedef char stepgen_ch_size_check[(sizeof(stepgen_ch_t) <= 16) ? 1 : -1];
 
 // uses with GPIO module macros
 extern volatile uint32_t * gpio_port_data[GPIO_PORTS_CNT];
+extern uint32_t gpio_port_set_mask[GPIO_PORTS_CNT];
+extern uint32_t gpio_port_clear_mask[GPIO_PORTS_CNT];
+extern uint8_t gpio_port_dirty;
+
+
+
+
+#if STEPGEN_PIN_INVERT
+#define PIN_HIGH(t) (SG.pin_state[t] ^ PIN.pin_invert[t])   // pin output level
+#else
+#define PIN_HIGH(t) (SG.pin_state[t])
+#endif
 
 
 
 
 // private functions
 
-static void busy(uint8_t c)
+SYS_HOT static void toggle_pin(uint8_t c, uint8_t t)
 {
-    // we need to increase max channel ID?
-    if ( c > max_id ) max_id = c;
+    if ( PIN_HIGH(t) )
+        GPIO_PIN_SET(PIN.pin_port[t], PIN.pin_mask[t]);
+    else
+        GPIO_PIN_CLEAR(PIN.pin_port[t], PIN.pin_mask_not[t]);
 }
 
-static void idle(uint8_t c)
+SYS_HOT static void toggle_pin_later(uint8_t c, uint8_t t)
 {
-    // no need to decrease max channel ID?
-    if ( !max_id || c != max_id ) return;
-    // decrease max channel ID
-    for ( max_id--; gen[max_id].tasks[SLOT].pulses; max_id-- );
+#if STEPGEN_GPIO_BATCH
+    // the real pin update will be made by gpio_port_flush()
+    if ( PIN_HIGH(t) )
+        GPIO_PIN_SET_LATER(PIN.pin_port[t], PIN.pin_mask[t], PIN.pin_mask_not[t]);
+    else
+        GPIO_PIN_CLEAR_LATER(PIN.pin_port[t], PIN.pin_mask[t], PIN.pin_mask_not[t]);
+#else
+    toggle_pin(c, t);
+#endif
 }
 
-static void toggle_pin(uint8_t c, uint8_t t)
+SYS_HOT static void start_task(uint8_t c)
 {
-    if ( SG.pin_state[t] ^ SG.pin_invert[t] )
-        GPIO_PIN_SET(SG.pin_port[t], SG.pin_mask[t]);
-    else
-        GPIO_PIN_CLEAR(SG.pin_port[t], SG.pin_mask_not[t]);
+    START.decel = 0;
+
+    if ( IS_DIR ) // DIR task
+    {
+        TASK.pulses = 2;
+        SG.task_tick += TASK.low_ticks;
+    }
+    else // STEP or RAMP task
+    {
+#if STEPGEN_LOOP
+        // host tasks don't keep the DIR state of the correction tasks
+        if ( !TASK.corr )
+        {
+            if ( TASK.dir == STEPGEN_DIR_KEEP ) TASK.dir = START.host_dir;
+            START.host_dir = TASK.dir;
+        }
+#endif
+
+        // the task changes DIR and the lookahead didn't make it?
+        if ( TASK.dir != STEPGEN_DIR_KEEP && TASK.dir != SG.pin_state[1] )
+        {
+            // the DIR hold time of the previous step isn't over?
+            if ( START.dir_state == DIR_HOLD && !TIMER_TICK_DUE(START.dir_tick, SG.task_tick) )
+            {
+                SG.task_tick = START.dir_tick;
+                SG.dir_wait = 1;
+                return;
+            }
+
+            SG.pin_state[1] = TASK.dir;
+            toggle_pin_later(c, 1);
+            START.dir_state = DIR_SETUP;
+            START.dir_tick = SG.task_tick;
+        }
+
+        // the DIR setup time before the first step isn't over?
+        if ( START.dir_state == DIR_SETUP && !TIMER_TICK_DUE(START.dir_tick + PIN.dir_setup_ticks, SG.task_tick) )
+        {
+            SG.task_tick = START.dir_tick + PIN.dir_setup_ticks;
+            SG.dir_wait = 1;
+            return;
+        }
+
+        START.dir_state = DIR_NONE;
+
+        if ( TASK.type == STEPGEN_TASK_RAMP )
+        {
+            RAMP.period = (int64_t)(TASK.low_ticks + TASK.high_ticks) << 16;
+            RAMP.k = TASK.ramp_k;
+        }
+
+#if STEPGEN_INFINITE
+        SG.task_infinite = TASK.pulses > INT32_MAX ? 1 : 0;
+#endif
+        SG.pin_state[0] = 1;
+        SG.task_tick += TASK.high_ticks;
+        toggle_pin_later(c, 0);
+    }
+}
+
+static void start_channel(uint8_t c, uint32_t tick)
+{
+    SG.task_tick = tick;
+    SG.dir_wait = 0;
+
+    // the DIR hold time of the last step before the idle time is over?
+    if ( START.dir_state != DIR_HOLD || (uint32_t)(START.dir_tick - tick) > PIN.dir_hold_ticks )
+        START.dir_state = DIR_NONE;
+
+    start_task(c);
+
+    // channel is busy from now
+    sched_add(SCHED_ID(SCHED_STEPGEN, c), SG.task_tick);
 }
 
-static void goto_next_task(uint8_t c)
+/*
+ * the next period of the RAMP task, without divisions:
+ *
+ *      p' = p * (1 + k + 1.5*k^2)
+ *      k' = k * (p'/p)^2
+ *
+ * where k = -a*p^2 (a = acceleration in steps/tick^2)
+ */
+SYS_HOT static void ramp_next(uint8_t c)
 {
-    static uint8_t i, slot;
+    int64_t k = RAMP.k, p = RAMP.period, f, g, end;
+
+    // f = k + 1.5*k^2 (Q40)
+    f = (k >> 10) * (k >> 10) >> 20;
+    f = k + f + (f >> 1);
+
+    // p = p + p*f (Q16)
+    p += ((p >> 16) * (f >> 10) >> 14) + ((p & 0xFFFF) * (f >> 10) >> 30);
 
-    // find next task
-    for ( i = STEPGEN_FIFO_SIZE, slot = SLOT + 1; i--; slot++ )
+    // k = k + k*((1 + f)^2 - 1) (Q40)
+    g = (1LL << 30) + (f >> 10);
+    g = (g * g >> 30) - (1LL << 30);
+    k += (k >> 10) * g >> 20;
+
+    // the end period reached?
+    end = (int64_t)TASK.ramp_end << 16;
+    if ( RAMP.k < 0 ? p <= end : p >= end ) { p = end; k = 0; }
+
+    RAMP.period = p;
+    RAMP.k = k;
+    TASK.low_ticks = (uint32_t)(p >> 16) - TASK.high_ticks;
+}
+
+/*
+ * called at the falling edge of the last step of the task,
+ * the DIR change of the next task is made during the low phase if it's legal
+ */
+SYS_HOT static void dir_lookahead(uint8_t c)
+{
+    stepgen_fifo_slot_t *next = &fifo[c][(SG.fifo_head + 1) & STEPGEN_FIFO_MASK];
+    uint8_t hold = PIN.dir_hold_ticks > TASK.high_ticks ? 1 : 0;
+
+    // the hold time isn't over at this edge? - start_task() or start_channel() will wait for it,
+    // the next task can be added later
+    if ( hold )
+    {
+        START.dir_tick = SG.task_tick - TASK.low_ticks - TASK.high_ticks + PIN.dir_hold_ticks;
+        START.dir_state = DIR_HOLD;
+    }
+
+    // no next task yet? OR it doesn't change DIR? OR the hold time isn't over?
+    if ( (uint8_t)(SG.fifo_tail - SG.fifo_head) < 2 || SG.abort ) return;
+    if ( next->type == STEPGEN_TASK_DIR || next->dir == STEPGEN_DIR_KEEP || next->dir == SG.pin_state[1] ) return;
+    if ( hold ) return;
+
+    // this step will be counted with the new DIR state
+    SG.pos += SG.pin_state[1] ? -2 : 2;
+
+    SG.pin_state[1] = next->dir;
+    toggle_pin_later(c, 1);
+    START.dir_state = DIR_SETUP;
+    START.dir_tick = SG.task_tick - TASK.low_ticks;
+}
+
+SYS_HOT static void goto_next_task(uint8_t c)
+{
+    // free current slot
+    ++SG.fifo_head;
+
+    // have we more tasks to do?
+    if ( BUSY ) start_task(c);
+}
+
+/// K_ONE/(2*n) for 0 < n <= INT32_MAX, without the 64-bit division
+static int64_t decel_k(uint32_t n)
+{
+    uint32_t r = 0x80000000U % n;
+    uint64_t q = 0x80000000U / n; // 2^31 / n
+    uint8_t i;
+
+    // 8 more quotient bits for 2^39 / n, r < n, so (r << 1) fits
+    for ( i = 8; i--; )
     {
-        if ( slot >= STEPGEN_FIFO_SIZE ) slot = 0;
-        if ( SG.tasks[slot].pulses ) break;
+        q <<= 1; r <<= 1;
+        if ( r >= n ) { r -= n; q |= 1; }
     }
 
-    // no more tasks to do?
-    if ( !SG.tasks[slot].pulses ) { idle(c); return; }
+    return (int64_t)q;
+}
 
-    // save new task slot
-    SLOT = slot;
+/*
+ * called at the end of a step, turns the current task into a RAMP task
+ * with the constant deceleration to a stop, k = 1/(2*steps to stop),
+ * returns 0 if the channel must stop right now
+ */
+static uint8_t decel_start(uint8_t c)
+{
+    uint8_t slot = (uint8_t)(START.abort_tail - 1) & STEPGEN_FIFO_MASK;
+    uint32_t period = TASK.low_ticks + TASK.high_ticks;
+    uint64_t v2;
+    uint32_t n;
+
+    // not a moving channel? OR DIR is already changed for the next task?
+    if ( IS_DIR || START.dir_state == DIR_SETUP || !PIN.decel_inv || !period ) return 0;
 
-    // start task
-    if ( SG.tasks[slot].type ) // DIR task
+    // the deceleration is running already? - drop newer tasks only
+    if ( !START.decel )
     {
-        SG.tasks[slot].pulses = 2;
-        SG.task_tick += SG.tasks[slot].low_ticks;
+        // steps to stop, n = v^2 / (2*a), v^2 >= a * 2^32 gives n >= 2^31
+        v2 = TIMER_FREQUENCY / period;
+        v2 *= v2;
+        if ( (v2 >> 32) >= PIN.decel ) n = INT32_MAX;
+        else
+        {
+            // the truncated 1/(2*a) gives a few steps less, the exact floor is just above
+            n = (uint32_t)(((v2 >> PIN.decel_shift) * PIN.decel_inv) >> 32);
+            while ( (uint64_t)(n + 1) * 2 * PIN.decel <= v2 ) ++n;
+        }
+        if ( !n ) return 0;
+
+        TASK.type = STEPGEN_TASK_RAMP;
+        TASK.dir = STEPGEN_DIR_KEEP;
+        TASK.pulses = n + 1; // +1 for the step done
+        TASK.ramp_end = UINT32_MAX >> 1;
+        RAMP.period = (int64_t)period << 16;
+        RAMP.k = decel_k(n);
+#if STEPGEN_INFINITE
+        SG.task_infinite = 0;
+#endif
+        START.decel = 1;
     }
-    else // STEP task
+
+    // the deceleration replaces all tasks added before the abort
+    if ( slot != SLOT )
     {
-        SG.task_infinite = SG.tasks[slot].pulses > INT32_MAX ? 1 : 0;
-        SG.pin_state[SG.tasks[slot].type] = 1;
-        SG.task_tick += SG.tasks[slot].high_ticks;
-        toggle_pin(c, SG.tasks[slot].type);
+        fifo[c][slot] = TASK;
+        SG.fifo_head = START.abort_tail - 1;
     }
+
+    START.dir_state = DIR_NONE;
+    SG.abort = 0;
+
+    return 1;
 }
 
 static void abort(uint8_t c)
 {
-    if ( SG.abort > 1 )
+    // abort tasks added before abort command only
+    if ( SG.abort > 1 ) SG.fifo_head = START.abort_tail;
+    // abort current task only
+    else ++SG.fifo_head;
+
+    SG.abort = 0;
+
+    // have we more tasks to do?
+    if ( BUSY ) start_task(c);
+}
+
+
+
+
+SYS_HOT static void process(uint8_t c)
+{
+    // channel disabled?
+    if ( !BUSY ) return;
+
+    if ( IS_DIR ) // DIR task
     {
-        // fifo cleanup
-        uint8_t i;
-        for ( i = STEPGEN_FIFO_SIZE; i--; )
+        if ( SG.abort ) { abort(c); return; }
+        if ( TASK.pulses < 2 ) { goto_next_task(c); return; } // dir task done
+
+        // hold
+        SG.pin_state[1] = SG.pin_state[1] ? 0 : 1;
+#if STEPGEN_LOOP
+        START.host_dir = SG.pin_state[1];
+#endif
+        SG.task_tick += TASK.high_ticks;
+        TASK.pulses--;
+        toggle_pin_later(c, 1);
+    }
+    else // STEP or RAMP task
+    {
+        if ( SG.pin_state[0] ) // high
         {
-            // abort tasks added before abort command only
-            if ( SG.tasks[i].pulses && SG.tasks[i].tick < SG.abort_tick ) {
-                SG.tasks[i].pulses = 0;
+            SG.pin_state[0] = 0;
+            SG.task_tick += TASK.low_ticks;
+            if ( TASK.pulses == 1 ) dir_lookahead(c); // the last step
+        }
+        else // low
+        {
+            // the first step waits for the DIR timing?
+            if ( SG.dir_wait )
+            {
+                SG.dir_wait = 0;
+                if ( SG.abort ) abort(c);
+                else start_task(c);
+                return;
             }
+
+            SG.pos += SG.pin_state[1] ? -1 : 1;
+#if STEPGEN_LOOP
+            if ( TASK.corr ) LOOP.corr += TASK.dir ? -1 : 1;
+#endif
+
+            if ( SG.abort && (SG.abort < 3 || !decel_start(c)) ) { abort(c); return; }
+#if STEPGEN_INFINITE
+            if ( !SG.task_infinite )
+#endif
+            TASK.pulses--;
+            if ( TASK.pulses ) // have we more steps to do?
+            {
+                if ( RAMP.k && TASK.type == STEPGEN_TASK_RAMP ) ramp_next(c);
+                SG.pin_state[0] = 1;
+                SG.task_tick += TASK.high_ticks;
+            }
+            else { goto_next_task(c); return; } // step task done
         }
-        // free channel id
-        idle(c);
-    }
-    else
-    {
-        TASK.pulses = 0;
-        goto_next_task(c);
+
+        toggle_pin_later(c, 0);
     }
+}
 
-    SG.abort = 0;
+#if STEPGEN_WATCHDOG
+static int8_t watchdog(uint32_t * deadline)
+{
+    uint8_t c;
+
+    // watchdog disabled?
+    if ( !wd_enabled ) { wd_scheduled = 0; return -1; }
+
+    // the wait time was updated by a message?
+    if ( !TIMER_TICK_DUE(wd_todo_tick, sched_tick) ) { *deadline = wd_todo_tick; return 0; }
+
+    // disable watchdog
+    wd_enabled = 0;
+    wd_scheduled = 0;
+
+    // stop all active channels
+    for ( c = STEPGEN_CH_CNT; c--; ) if ( BUSY ) stepgen_abort(c, STEPGEN_ABORT_DECEL);
+
+    return -1;
+}
+#endif
+
+#if STEPGEN_LOOP
+/// encoder position of the channel (in steps)
+static int32_t loop_pos(uint8_t c)
+{
+    return (int32_t)(((int64_t)encoder_counts_get(LOOP.enc) * LOOP.scale) >> 16) + LOOP.offset;
+}
+
+/// add a STEP task to make the idle channel error zero
+static void loop_task_add(uint8_t c, int32_t error)
+{
+    stepgen_fifo_slot_t *slot = &fifo[c][SG.fifo_tail & STEPGEN_FIFO_MASK];
+
+    slot->type = STEPGEN_TASK_STEP;
+    slot->dir = error < 0 ? 1 : 0;
+    slot->pulses = error < 0 ? -error : error;
+    slot->low_ticks = LOOP.low_ticks;
+    slot->high_ticks = LOOP.high_ticks;
+    slot->corr = 1;
+
+    ++SG.fifo_tail;
+
+    start_channel(c, TIMER_CNT_GET() + 9000);
+}
+
+/*
+ * one correction step per done step of the host task,
+ * the extra step makes the task one period longer,
+ * the skipped step makes it one period shorter
+ */
+static void loop_correct(uint8_t c, int32_t error)
+{
+    int8_t s;
+
+    if ( !BUSY ) { if ( !SG.staged ) loop_task_add(c, error); return; }
+
+    // not a moving host task? OR the last step? OR no steps since the last correction?
+    if ( IS_DIR || TASK.corr || SG.abort || START.decel || SG.dir_wait ) return;
+    if ( TASK.pulses < 2 || SG.pos == LOOP.corr_pos ) return;
+#if STEPGEN_INFINITE
+    if ( SG.task_infinite ) return;
+#endif
+
+    s = SG.pin_state[1] ? -1 : 1;
+
+    // the motor is behind? - one more step, ahead? - one step less
+    if ( (error > 0) == (s > 0) ) { TASK.pulses++; LOOP.corr += s; }
+    else { TASK.pulses--; LOOP.corr -= s; }
+
+    LOOP.corr_pos = SG.pos;
+}
+#endif
+
+SYS_HOT static int8_t sched_process(uint8_t c, uint32_t * deadline)
+{
+#if STEPGEN_WATCHDOG
+    if ( c == SCHED_WATCHDOG_CH ) return watchdog(deadline);
+#endif
+
+    PERF_LATENESS(c, sched_tick - SG.task_tick);
+
+    process(c);
+
+    // put the channel back to the scheduler?
+    if ( !BUSY ) return -1;
+
+    *deadline = SG.task_tick;
+    return 0;
 }
 
 
@@ -119,88 +490,66 @@ static void abort(uint8_t c)
 
 /**
  * @brief   module init
- * @note    call this function only once before stepgen_module_base_thread()
+ * @note    call this function only once before sched_module_init()
  * @retval  none
  */
 void stepgen_module_init()
 {
-    // start sys timer
-    TIMER_START();
-
     // add message handlers
     uint8_t i = 0;
     for ( i = STEPGEN_MSG_PIN_SETUP; i < STEPGEN_MSG_CNT; i++ )
     {
         msg_recv_callback_add(i, (msg_recv_func_t) stepgen_msg_recv);
     }
+
+    // channels are processed by the scheduler
+    sched_func_set(SCHED_STEPGEN, sched_process);
 }
 
+#if STEPGEN_LOOP
 /**
- * @brief   module base thread
- * @note    call this function in the main loop, before gpio_module_base_thread()
+ * @brief   module base thread, the closed loop corrections
+ * @note    call this function in the main loop, after the encoder_module_base_thread()
  * @retval  none
  */
-void stepgen_module_base_thread()
+SYS_HOT void stepgen_module_base_thread()
 {
     static uint8_t c;
+    static int32_t error;
 
-    // get current CPU tick
-    tick = timer_cnt_get_64();
+    // nothing to do?
+    if ( !loops_cnt ) return;
 
-    // watchdog enabled? AND it's time to abort all channels?
-    if ( wd_todo_tick && tick > wd_todo_tick )
+    for ( c = STEPGEN_CH_CNT; c--; )
     {
-        // disable watchdog
-        wd_todo_tick = 0;
-        // abort all active channels
-        for ( c = max_id + 1; c--; ) if ( TASK.pulses ) stepgen_abort(c, 1);
-    }
+        if ( !LOOP.enabled ) continue;
 
-    // check all working channels
-    for ( c = max_id + 1; c--; )
-    {
-        // channel disabled?
-        if ( !TASK.pulses ) continue;
-        // it's not a time for a pulse?
-        if ( tick < SG.task_tick ) continue;
+        // the channel state must not be changed by the scheduler
+        TIMER_IRQ_LOCK();
 
-        if ( TASK.type ) // DIR task
-        {
-            if ( SG.abort ) { abort(c); continue; }
-            if ( TASK.pulses > 1 ) // hold
-            {
-                SG.pin_state[TASK.type] = SG.pin_state[TASK.type] ? 0 : 1;
-                SG.task_tick += TASK.high_ticks;
-            }
-            else goto_next_task(c); // dir task done
+        error = SG.pos - LOOP.corr - loop_pos(c);
+        LOOP.error = error;
+        if ( error < 0 ) error = -error;
 
-            TASK.pulses--;
-        }
-        else // STEP task
+        if ( LOOP.max_error && (uint32_t)error > LOOP.max_error )
         {
-            if ( SG.pin_state[TASK.type] ) // high
-            {
-                SG.pin_state[TASK.type] = 0;
-                SG.task_tick += TASK.low_ticks;
-            }
-            else // low
-            {
-                SG.pos += SG.pin_state[1] ? -1 : 1;
-
-                if ( SG.abort ) { abort(c); continue; }
-                if ( !SG.task_infinite ) TASK.pulses--;
-                if ( TASK.pulses ) // have we more steps to do?
-                {
-                    SG.pin_state[TASK.type] = 1;
-                    SG.task_tick += TASK.high_ticks;
-                }
-                else goto_next_task(c); // step task done
-            }
+            LOOP.enabled = 0;
+            LOOP.fault = 1;
+            --loops_cnt;
+            stepgen_abort(c, STEPGEN_ABORT_DECEL);
         }
+        else if ( (uint32_t)error > LOOP.deadband ) loop_correct(c, LOOP.error);
 
-        toggle_pin(c, TASK.type);
+#if STEPGEN_GPIO_BATCH
+        // the first edges of the correction task,
+        // the scheduler (TIMER_IRQ_MODE) flushes the same masks
+        gpio_port_flush();
+#endif
+
+        TIMER_IRQ_UNLOCK();
     }
 }
+#endif
 
 
 
@@ -221,10 +570,15 @@ void stepgen_pin_setup(uint8_t c, uint8_t type, uint8_t port, uint8_t pin, uint8
     gpio_pin_setup_for_output(port, pin);
 
     SG.pin_state[type] = 0;
-    SG.pin_port[type] = port;
-    SG.pin_mask[type] = 1U << pin;
-    SG.pin_mask_not[type] = ~(SG.pin_mask[type]);
-    SG.pin_invert[type] = invert ? 1 : 0;
+#if STEPGEN_LOOP
+    if ( type ) START.host_dir = 0;
+#endif
+    PIN.pin_port[type] = port;
+    PIN.pin_mask[type] = 1U << pin;
+    PIN.pin_mask_not[type] = ~(PIN.pin_mask[type]);
+#if STEPGEN_PIN_INVERT
+    PIN.pin_invert[type] = invert ? 1 : 0;
+#endif
 
     toggle_pin(c, type);
 }
@@ -235,66 +589,155 @@ void stepgen_pin_setup(uint8_t c, uint8_t type, uint8_t port, uint8_t pin, uint8
 /**
  * @brief   add a new task for the selected channel
  *
+ * @note    STEP task with the STEPGEN_TASK_DIR_SET flag changes the DIR pin
+ *          before the first step, no DIR task is needed then,
+ *          see stepgen_dir_timing_setup()
+ *
  * @param   c               channel id
- * @param   type            0:step, 1:dir
+ * @param   type            0:step, 1:dir (| STEPGEN_TASK_TICKS if times are in CPU ticks)
+ *                          (| STEPGEN_TASK_DIR_SET [| STEPGEN_TASK_DIR_VALUE] for the STEP task)
  * @param   pulses          number of pulses (ignored for DIR task)
  * @param   pin_low_time    pin LOW state duration (in nanoseconds)
  * @param   pin_high_time   pin HIGH state duration (in nanoseconds)
  *
- * @retval  none
+ * @retval   0 (task added)
+ * @retval  -1 (task not added)
  */
-void stepgen_task_add(uint8_t c, uint8_t type, uint32_t pulses, uint32_t pin_low_time, uint32_t pin_high_time)
+int8_t stepgen_task_add(uint8_t c, uint8_t type, uint32_t pulses, uint32_t pin_low_time, uint32_t pin_high_time)
 {
-    uint8_t i, slot;
+    uint8_t idle = BUSY ? 0 : 1;
+    uint8_t ticks = type & STEPGEN_TASK_TICKS;
+    uint8_t dir = !(type & STEPGEN_TASK_DIR_SET) ? STEPGEN_DIR_KEEP : (type & STEPGEN_TASK_DIR_VALUE ? 1 : 0);
+    stepgen_fifo_slot_t *slot = &fifo[c][SG.fifo_tail & STEPGEN_FIFO_MASK];
+
+    type &= ~(STEPGEN_TASK_TICKS | STEPGEN_TASK_DIR_SET | STEPGEN_TASK_DIR_VALUE);
+
+    // no free slots? OR empty STEP task?
+    if ( FULL || (!type && !pulses) ) return -1;
 
-    if ( TASK.pulses )
+    slot->type = type ? STEPGEN_TASK_DIR : STEPGEN_TASK_STEP;
+    slot->dir = type ? STEPGEN_DIR_KEEP : dir;
+    slot->pulses = type ? 2 : pulses;
+    slot->low_ticks = ticks ? pin_low_time : NS_TO_TICKS(pin_low_time);
+    slot->high_ticks = ticks ? pin_high_time : NS_TO_TICKS(pin_high_time);
+#if STEPGEN_LOOP
+    slot->corr = 0;
+#endif
+
+    ++SG.fifo_tail;
+
+    // start a task right now?
+    if ( idle && !SG.staged )
     {
-        // find free fifo slot for the new task
-        for ( i = STEPGEN_FIFO_SIZE, slot = SLOT; i--; slot++ )
-        {
-            if ( slot >= STEPGEN_FIFO_SIZE ) slot = 0;
-            if ( !SG.tasks[slot].pulses ) break;
-        }
+        start_channel(c, TIMER_CNT_GET() + 9000);
+#if STEPGEN_GPIO_BATCH
+        gpio_port_flush();
+#endif
+    }
+
+    return 0;
+}
+
+/**
+ * @brief   add a list of new tasks
+ *
+ * @note    tasks are added in the list order,
+ *          the first rejected task stops the processing
+ *
+ * @param   batch   pointer to the list of tasks
+ *
+ * @retval  number of added tasks
+ */
+uint8_t stepgen_task_add_batch(stepgen_msg_batch_t *batch)
+{
+    uint8_t i, cnt = batch->cnt;
+    stepgen_msg_task_t *t;
 
-        // no free slots?
-        if ( SG.tasks[slot].pulses ) return;
+    if ( cnt > STEPGEN_MSG_BATCH_CNT ) cnt = STEPGEN_MSG_BATCH_CNT;
+
+    for ( i = 0; i < cnt; i++ )
+    {
+        t = &batch->tasks[i];
+        if ( t->c >= STEPGEN_CH_CNT ) break;
+        if ( stepgen_task_add(t->c, t->type, t->pulses, t->pin_low_time, t->pin_high_time) ) break;
     }
-    else slot = SLOT;
 
-    busy(c);
+    return i;
+}
 
-    SG.tasks[slot].tick = tick;
-    SG.tasks[slot].type = type;
-    SG.tasks[slot].pulses = type ? 2 : pulses;
-    SG.tasks[slot].low_ticks = (uint32_t) ( (uint64_t)pin_low_time *
-        (uint64_t)TIMER_FREQUENCY_MHZ / (uint64_t)1000 );
-    SG.tasks[slot].high_ticks = (uint32_t) ( (uint64_t)pin_high_time *
-        (uint64_t)TIMER_FREQUENCY_MHZ / (uint64_t)1000 );
+/**
+ * @brief   add a new RAMP task for the selected channel
+ *
+ * @note    step period changes from the start to the end value
+ *          with a constant acceleration, the pin HIGH state duration is fixed
+ *
+ * @param   c               channel id
+ * @param   pulses          number of pulses (1..INT32_MAX)
+ * @param   start_period    the first step period (in nanoseconds)
+ * @param   end_period      the last step period (in nanoseconds)
+ * @param   pin_high_time   pin HIGH state duration (in nanoseconds)
+ *
+ * @retval   0 (task added)
+ * @retval  -1 (task not added)
+ */
+int8_t stepgen_ramp_add(uint8_t c, uint32_t pulses, uint32_t start_period, uint32_t end_period, uint32_t pin_high_time)
+{
+    uint8_t idle = BUSY ? 0 : 1;
+    stepgen_fifo_slot_t *slot = &fifo[c][SG.fifo_tail & STEPGEN_FIFO_MASK];
+    uint32_t p0, p1, high;
+    uint64_t r, d;
+
+    // no free slots? OR empty task?
+    if ( FULL || !pulses || pulses > INT32_MAX ) return -1;
+
+    p0 = NS_TO_TICKS(start_period);
+    p1 = NS_TO_TICKS(end_period);
+    high = NS_TO_TICKS(pin_high_time);
+
+    // periods are too short? OR too big periods ratio?
+    if ( p0 <= high || p1 <= high ) return -1;
+    if ( (uint64_t)p0 >= ((uint64_t)p1 << 15) ) return -1;
+
+    // k = (1 - (p0/p1)^2) / (2*pulses)
+    r = ((uint64_t)p0 << 30) / p1;
+    r = r < (1ULL << 32) ? (r * r) >> 30 : (r >> 15) * (r >> 15);
+    r <<= 10;
+    d = r > STEPGEN_RAMP_K_ONE ? r - STEPGEN_RAMP_K_ONE : STEPGEN_RAMP_K_ONE - r;
+    d /= 2 * (uint64_t)pulses;
+
+    // too short ramp for this speed change?
+    if ( d >= (STEPGEN_RAMP_K_ONE >> 1) ) return -1;
+
+    slot->type = STEPGEN_TASK_RAMP;
+    slot->dir = STEPGEN_DIR_KEEP;
+    slot->pulses = pulses;
+    slot->low_ticks = p0 - high;
+    slot->high_ticks = high;
+    slot->ramp_end = p1;
+    slot->ramp_k = r > STEPGEN_RAMP_K_ONE ? -(int64_t)d : (int64_t)d;
+#if STEPGEN_LOOP
+    slot->corr = 0;
+#endif
+
+    ++SG.fifo_tail;
 
     // start a task right now?
-    if ( slot == SLOT )
+    if ( idle && !SG.staged )
     {
-        SG.task_tick = tick + 9000;
-
-        if ( type )
-        {
-            SG.task_tick += SG.tasks[slot].low_ticks;
-        }
-        else
-        {
-            SG.task_infinite = SG.tasks[slot].pulses > INT32_MAX ? 1 : 0;
-            SG.pin_state[type] = 1;
-            SG.task_tick += SG.tasks[slot].high_ticks;
-            toggle_pin(c, type);
-        }
+        start_channel(c, TIMER_CNT_GET() + 9000);
+#if STEPGEN_GPIO_BATCH
+        gpio_port_flush();
+#endif
     }
+
+    return 0;
 }
 
 /**
  * @brief   update time values for the current task
  *
  * @param   c               channel id
- * @param   type            0:step, 1:dir
+ * @param   type            0:step, 1:dir (| STEPGEN_TASK_TICKS if times are in CPU ticks)
  * @param   pin_low_time    pin LOW state duration (in nanoseconds)
  * @param   pin_high_time   pin HIGH state duration (in nanoseconds)
  *
@@ -302,28 +745,146 @@ void stepgen_task_add(uint8_t c, uint8_t type, uint32_t pulses, uint32_t pin_low
  */
 void stepgen_task_update(uint8_t c, uint8_t type, uint32_t pin_low_time, uint32_t pin_high_time)
 {
+    uint8_t ticks = type & STEPGEN_TASK_TICKS;
+
+    type &= ~STEPGEN_TASK_TICKS;
+
     // is idle OR task type is different?
-    if ( !TASK.pulses || SG.tasks[SLOT].type != type ) return;
+    if ( !BUSY || TASK.type != type ) return;
 
-    TASK.low_ticks = (uint32_t) ( (uint64_t)pin_low_time *
-        (uint64_t)TIMER_FREQUENCY_MHZ / (uint64_t)1000 );
-    TASK.high_ticks = (uint32_t) ( (uint64_t)pin_high_time *
-        (uint64_t)TIMER_FREQUENCY_MHZ / (uint64_t)1000 );
+    TASK.low_ticks = ticks ? pin_low_time : NS_TO_TICKS(pin_low_time);
+    TASK.high_ticks = ticks ? pin_high_time : NS_TO_TICKS(pin_high_time);
 }
 
 
 
 
 /**
- * @brief   abort all tasks for the selected channel
+ * @brief   setup the DIR timing for the inline DIR changes
+ *
+ * @note    DIR changes at the falling edge of the last step
+ *          if the hold time is over, so the setup time overlaps the low phase
+ *
+ * @param   c               channel id
+ * @param   setup_time      DIR change to the next step rising edge (in nanoseconds)
+ * @param   hold_time       step rising edge to the next DIR change (in nanoseconds)
+ *
+ * @retval   0 (done)
+ * @retval  -1 (invalid channel OR time above STEPGEN_DIR_TIME_MAX)
+ */
+int8_t stepgen_dir_timing_setup(uint8_t c, uint32_t setup_time, uint32_t hold_time)
+{
+    if ( c >= STEPGEN_CH_CNT || setup_time > STEPGEN_DIR_TIME_MAX || hold_time > STEPGEN_DIR_TIME_MAX ) return -1;
+
+    PIN.dir_setup_ticks = NS_TO_TICKS(setup_time);
+    PIN.dir_hold_ticks = NS_TO_TICKS(hold_time);
+
+    return 0;
+}
+
+/**
+ * @brief   hold new tasks of the idle channel until stepgen_commit()
+ *
+ * @note    use it to start a coordinated move of several channels,
+ *          all staged channels will start at the same CPU tick
+ *
+ * @param   c   channel id
+ *
+ * @retval   0 (channel staged)
+ * @retval  -1 (channel is busy)
+ */
+int8_t stepgen_stage(uint8_t c)
+{
+    if ( c >= STEPGEN_CH_CNT || (BUSY && !SG.staged) ) return -1;
+
+    SG.staged = 1;
+
+    return 0;
+}
+
+/**
+ * @brief   start tasks of all staged channels
+ * @param   start_delay     delay before the start (in nanoseconds, 0 = default delay)
+ * @retval  number of started channels
+ */
+uint8_t stepgen_commit(uint32_t start_delay)
+{
+    uint32_t tick = TIMER_CNT_GET() + (start_delay ? NS_TO_TICKS(start_delay) : 9000);
+    uint8_t c, cnt = 0;
+
+    for ( c = STEPGEN_CH_CNT; c--; )
+    {
+        if ( !SG.staged ) continue;
+
+        SG.staged = 0;
+        if ( !BUSY ) continue;
+
+        start_channel(c, tick);
+        ++cnt;
+    }
+
+#if STEPGEN_GPIO_BATCH
+    // the first edges of all channels at once
+    gpio_port_flush();
+#endif
+
+    return cnt;
+}
+
+
+
+
+/**
+ * @brief   setup the deceleration of the STEPGEN_ABORT_DECEL abort
+ *
+ * @param   c       channel id
+ * @param   decel   deceleration (in steps/s^2), 0 = instant stop
+ *
+ * @note    the watchdog uses the STEPGEN_ABORT_DECEL abort too
+ *
+ * @retval   0 (done)
+ * @retval  -1 (invalid channel OR deceleration above STEPGEN_DECEL_MAX)
+ */
+int8_t stepgen_decel_setup(uint8_t c, uint32_t decel)
+{
+    if ( c >= STEPGEN_CH_CNT || decel > STEPGEN_DECEL_MAX ) return -1;
+
+    // the abort does the steps to stop math with the IRQ disabled, so the division is here,
+    // 1/(2*decel) is normalized to 31 bits, 2^shift <= decel
+    PIN.decel = decel;
+    for ( PIN.decel_shift = 0; (decel >> PIN.decel_shift) > 1; PIN.decel_shift++ );
+    PIN.decel_inv = decel ? (uint32_t)((0x80000000ULL << PIN.decel_shift) / decel) : 0;
+
+    return 0;
+}
+
+/**
+ * @brief   abort tasks for the selected channel
+ *
  * @param   c       channel id
- * @param   all     abort all task?
+ * @param   all     STEPGEN_ABORT_TASK, STEPGEN_ABORT_ALL or STEPGEN_ABORT_DECEL
+ *
+ * @note    STEPGEN_ABORT_DECEL ramps the current step period down
+ *          to a stop with the stepgen_decel_setup() deceleration,
+ *          then tasks added after the abort are started
+ *
  * @retval  none
  */
 void stepgen_abort(uint8_t c, uint8_t all)
 {
-    SG.abort = all ? 2 : 1;
-    SG.abort_tick = tick;
+    // nothing to abort?
+    if ( !BUSY ) return;
+
+    // tasks aren't started yet?
+    if ( SG.staged )
+    {
+        if ( all ) SG.fifo_head = SG.fifo_tail;
+        else ++SG.fifo_head;
+        return;
+    }
+
+    SG.abort = all == STEPGEN_ABORT_DECEL && PIN.decel ? 3 : all ? 2 : 1;
+    START.abort_tail = SG.fifo_tail;
 }
 
 
@@ -336,7 +897,12 @@ void stepgen_abort(uint8_t c, uint8_t all)
  */
 int32_t stepgen_pos_get(uint8_t c)
 {
+#if STEPGEN_LOOP
+    // correction steps aren't visible to the host
+    return SG.pos - LOOP.corr;
+#else
     return SG.pos;
+#endif
 }
 
 /**
@@ -347,12 +913,129 @@ int32_t stepgen_pos_get(uint8_t c)
  */
 void stepgen_pos_set(uint8_t c, int32_t pos)
 {
+#if STEPGEN_LOOP
+    // the closed loop error stays the same
+    LOOP.offset += pos - (SG.pos - LOOP.corr);
+    LOOP.corr = 0;
+    LOOP.corr_pos = pos;
+#endif
     SG.pos = pos;
 }
 
+/**
+ * @brief   get number of used fifo slots
+ * @param   c   channel id
+ * @retval  0..STEPGEN_FIFO_SIZE
+ */
+uint8_t stepgen_fifo_fill_get(uint8_t c)
+{
+    return (uint8_t)(SG.fifo_tail - SG.fifo_head);
+}
+
 
 
 
+#if STEPGEN_LOOP
+/**
+ * @brief   bind the selected channel to the encoder channel
+ *
+ * @note    the encoder position (counts * scale) follows the commanded position,
+ *          an error above the deadband adds one step per step of the running task,
+ *          the idle channel makes the whole correction at the correction period,
+ *          the deadband must cover the motor lag at the max speed
+ *
+ * @param   c           channel id
+ * @param   enc         encoder channel id
+ * @param   scale       steps per encoder count (Q16, 65536 = 1.0), must not be 0
+ * @param   deadband    max error without corrections (in steps)
+ * @param   max_error   error to abort the channel with STEPGEN_ABORT_DECEL (in steps), 0 = no limit
+ * @param   period      step period of the idle channel corrections (in nanoseconds)
+ *
+ * @retval   0 (the loop is enabled)
+ * @retval  -1 (invalid channel, scale OR period below STEPGEN_LOOP_PERIOD_MIN)
+ */
+int8_t stepgen_loop_setup(uint8_t c, uint8_t enc, int32_t scale, uint32_t deadband, uint32_t max_error, uint32_t period)
+{
+    uint32_t ticks = NS_TO_TICKS(period);
+
+    if ( c >= STEPGEN_CH_CNT || enc >= ENCODER_CH_CNT || !scale || period < STEPGEN_LOOP_PERIOD_MIN ) return -1;
+
+    TIMER_IRQ_LOCK();
+
+    if ( LOOP.enabled ) --loops_cnt;
+
+    // done corrections become a part of the commanded position
+    SG.pos -= LOOP.corr;
+    LOOP.corr = 0;
+    LOOP.corr_pos = SG.pos;
+
+    LOOP.enc = enc;
+    LOOP.scale = scale;
+    LOOP.deadband = deadband;
+    LOOP.max_error = max_error;
+    LOOP.high_ticks = ticks / 2;
+    LOOP.low_ticks = ticks - LOOP.high_ticks;
+
+    // no error at the setup time
+    LOOP.offset = 0;
+    LOOP.offset = SG.pos - loop_pos(c);
+    LOOP.error = 0;
+    LOOP.fault = 0;
+    LOOP.enabled = 1;
+
+    ++loops_cnt;
+
+    TIMER_IRQ_UNLOCK();
+
+    return 0;
+}
+
+/**
+ * @brief   unbind the selected channel from the encoder channel
+ * @param   c   channel id
+ * @retval  none
+ */
+void stepgen_loop_disable(uint8_t c)
+{
+    if ( c >= STEPGEN_CH_CNT ) return;
+
+    TIMER_IRQ_LOCK();
+
+    if ( LOOP.enabled ) --loops_cnt;
+
+    // done corrections become a part of the commanded position
+    SG.pos -= LOOP.corr;
+    LOOP.corr = 0;
+    LOOP.fault = 0;
+    LOOP.enabled = 0;
+
+    TIMER_IRQ_UNLOCK();
+}
+
+/**
+ * @brief   get the closed loop state
+ *
+ * @param   c       channel id
+ * @param   error   pointer to the last error (in steps) or 0
+ * @param   corr    pointer to the number of done correction steps or 0
+ *
+ * @retval  0 (loop disabled)
+ * @retval  1 (loop enabled)
+ * @retval  2 (loop disabled by the max error)
+ */
+uint8_t stepgen_loop_state_get(uint8_t c, int32_t * error, int32_t * corr)
+{
+    if ( c >= STEPGEN_CH_CNT ) return 0;
+    if ( error ) *error = LOOP.error;
+    if ( corr ) *corr = LOOP.corr;
+    return LOOP.fault ? 2 : LOOP.enabled;
+}
+#endif
+
+
+
+
+#if STEPGEN_WATCHDOG
 /**
  * @brief   enable/disable `abort all` watchdog
  * @param   enable      0 = disable watchdog, other values - enable watchdog
@@ -361,11 +1044,20 @@ void stepgen_pos_set(uint8_t c, int32_t pos)
  */
 void stepgen_watchdog_setup(uint8_t enable, uint32_t time)
 {
-    if ( !enable ) { wd_todo_tick = 0; return; }
+    wd_enabled = enable ? 1 : 0;
+    if ( !enable ) return;
+
+    wd_ticks = NS_TO_TICKS(time);
+    wd_todo_tick = TIMER_CNT_GET() + wd_ticks;
 
-    wd_ticks = (uint64_t)time * (uint64_t)TIMER_FREQUENCY_MHZ / (uint64_t)1000;
-    wd_todo_tick = tick + wd_ticks;
+    // the watchdog is processed by the scheduler
+    if ( !wd_scheduled )
+    {
+        sched_add(SCHED_ID(SCHED_STEPGEN, SCHED_WATCHDOG_CH), wd_todo_tick);
+        wd_scheduled = 1;
+    }
 }
+#endif
 
 
 
@@ -386,10 +1078,12 @@ void stepgen_watchdog_setup(uint8_t enable, uint32_t time)
 int8_t volatile stepgen_msg_recv(uint8_t type, uint8_t * msg, uint8_t length)
 {
     u32_10_t *in = (u32_10_t*) msg;
-    u32_10_t *out = (u32_10_t*) msg_buf;
+    u32_10_t *out;
 
+#if STEPGEN_WATCHDOG
     // any incoming message will update the watchdog wait time
-    if ( wd_todo_tick ) wd_todo_tick = tick + wd_ticks;
+    if ( wd_enabled ) wd_todo_tick = TIMER_CNT_GET() + wd_ticks;
+#endif
 
     switch (type)
     {
@@ -406,19 +1100,66 @@ int8_t volatile stepgen_msg_recv(uint8_t type, uint8_t * msg, uint8_t length)
             stepgen_abort(in->v[0], in->v[1]);
             break;
         case STEPGEN_MSG_POS_GET:
+            out = (u32_10_t*) msg_reserve();
             out->v[0] = (uint32_t) stepgen_pos_get(in->v[0]);
-            msg_send(type, msg_buf, 4);
+            msg_commit(type, 4);
             break;
         case STEPGEN_MSG_POS_SET:
             stepgen_pos_set(in->v[0], (int32_t)in->v[1]);
             break;
+#if STEPGEN_WATCHDOG
         case STEPGEN_MSG_WATCHDOG_SETUP:
             stepgen_watchdog_setup(in->v[0], in->v[1]);
             break;
+#endif
+        case STEPGEN_MSG_TASK_ADD_BATCH:
+            out = (u32_10_t*) msg_reserve();
+            out->v[0] = stepgen_task_add_batch((stepgen_msg_batch_t*) msg);
+            msg_commit(type, 4);
+            break;
+        case STEPGEN_MSG_RAMP_ADD:
+            stepgen_ramp_add(in->v[0], in->v[1], in->v[2], in->v[3], in->v[4]);
+            break;
+        case STEPGEN_MSG_STAGE:
+            stepgen_stage(in->v[0]);
+            break;
+        case STEPGEN_MSG_COMMIT:
+            out = (u32_10_t*) msg_reserve();
+            out->v[0] = stepgen_commit(in->v[0]);
+            msg_commit(type, 4);
+            break;
+        case STEPGEN_MSG_DIR_TIMING_SETUP:
+            stepgen_dir_timing_setup(in->v[0], in->v[1], in->v[2]);
+            break;
+        case STEPGEN_MSG_DECEL_SETUP:
+            stepgen_decel_setup(in->v[0], in->v[1]);
+            break;
+#if STEPGEN_LOOP
+        case STEPGEN_MSG_LOOP_SETUP:
+            // scale 0 = disable the loop
+            if ( in->v[2] ) stepgen_loop_setup(in->v[0], in->v[1], (int32_t)in->v[2], in->v[3], in->v[4], in->v[5]);
+            else stepgen_loop_disable(in->v[0]);
+            break;
+        case STEPGEN_MSG_LOOP_STATE_GET:
+        {
+            int32_t error = 0, corr = 0;
+            out = (u32_10_t*) msg_reserve();
+            out->v[0] = stepgen_loop_state_get(in->v[0], &error, &corr);
+            out->v[1] = (uint32_t) error;
+            out->v[2] = (uint32_t) corr;
+            msg_commit(type, 3*4);
+            break;
+        }
+#endif
 
         default: return -1;
     }
 
+#if TIMER_IRQ_MODE
+    // the message could change the next deadline
+    sched_irq_thread();
+#endif
+
     return 0;
 }
 
@@ -433,12 +1174,14 @@ int8_t volatile stepgen_msg_recv(uint8_t type, uint8_t * msg, uint8_t length)
     @code
         #include <stdint.h>
         #include "mod_gpio.h"
+        #include "mod_sched.h"
         #include "mod_stepgen.h"
 
         int main(void)
         {
             // module init
             stepgen_module_init();
+            sched_module_init();
 
             // use GPIO pin PA3 for the channel 0 output
             stepgen_pin_setup(0, 1, PA, 3, 0);
@@ -451,10 +1194,95 @@ int8_t volatile stepgen_msg_recv(uint8_t type, uint8_t * msg, uint8_t length)
             // main loop
             for(;;)
             {
-                // real update of channel states
+                // real update of channel and pin states
+                sched_module_base_thread();
+            }
+
+            return 0;
+        }
+    @endcode
+
+    <b>Usage example 2</b>: start two axes at the same CPU tick
+
+    @code
+        #include <stdint.h>
+        #include "mod_gpio.h"
+        #include "mod_sched.h"
+        #include "mod_stepgen.h"
+
+        int main(void)
+        {
+            // module init
+            stepgen_module_init();
+            sched_module_init();
+
+            // STEP pins of the channels 0 and 1
+            stepgen_pin_setup(0, 0, PA, 3, 0);
+            stepgen_pin_setup(1, 0, PA, 6, 0);
+
+            // hold new tasks of both channels
+            stepgen_stage(0);
+            stepgen_stage(1);
+
+            // 1000 steps at 10 kHz and 500 steps at 5 kHz
+            stepgen_task_add(0, 0, 1000, 95000, 5000);
+            stepgen_task_add(1, 0, 500, 195000, 5000);
+
+            // start both channels 20 us later
+            stepgen_commit(20000);
+
+            // main loop
+            for(;;)
+            {
+                // real update of channel and pin states
+                sched_module_base_thread();
+            }
+
+            return 0;
+        }
+    @endcode
+
+    <b>Usage example 3</b>: the channel 0 follows the encoder channel 0
+
+    @code
+        #include <stdint.h>
+        #include "mod_gpio.h"
+        #include "mod_sched.h"
+        #include "mod_encoder.h"
+        #include "mod_stepgen.h"
+
+        int main(void)
+        {
+            // module init
+            stepgen_module_init();
+            encoder_module_init();
+            sched_module_init();
+
+            // STEP and DIR pins of the channel 0
+            stepgen_pin_setup(0, 0, PA, 3, 0);
+            stepgen_pin_setup(0, 1, PA, 6, 0);
+
+            // A/B encoder on the PA10 and PA11 pins
+            encoder_pin_setup(0, PHASE_A, PA, 10);
+            encoder_pin_setup(0, PHASE_B, PA, 11);
+            encoder_setup(0, 1, 0);
+            encoder_state_set(0, 1);
+
+            // 4 encoder counts per step, 2 steps of deadband,
+            // abort after 200 lost steps, corrections at 5 kHz
+            stepgen_loop_setup(0, 0, 65536 / 4, 2, 200, 200000);
+
+            // 1000 steps at 10 kHz
+            stepgen_task_add(0, 0, 1000, 95000, 5000);
+
+            // main loop
+            for(;;)
+            {
+                encoder_module_base_thread();
+                // compare the positions and add the correction steps
                 stepgen_module_base_thread();
-                // real update of pin states
-                gpio_module_base_thread();
+                // real update of channel and pin states
+                sched_module_base_thread();
             }
 
             return 0;
@@ -10,13 +10,43 @@
 #include <stdint.h>
 #include "mod_msg.h"
 #include "mod_timer.h"
+#include "mod_encoder.h"
 
 
 
 
+#ifndef STEPGEN_CH_CNT
 #define STEPGEN_CH_CNT          24  ///< maximum number of pulse generator channels
-#define STEPGEN_FIFO_SIZE       4   ///< size of channel's fifo buffer
-#define STEPGEN_MSG_BUF_LEN     MSG_LEN
+#endif
+#ifndef STEPGEN_FIFO_SIZE
+#define STEPGEN_FIFO_SIZE       16  ///< size of channel's fifo buffer (power of 2, 2..128)
+#endif
+#define STEPGEN_FIFO_MASK       (STEPGEN_FIFO_SIZE - 1)
+
+#ifndef STEPGEN_WATCHDOG
+/// 1 = `abort all` watchdog is available
+#define STEPGEN_WATCHDOG        1
+#endif
+
+#ifndef STEPGEN_INFINITE
+/// 1 = STEP tasks with more than INT32_MAX pulses never end
+#define STEPGEN_INFINITE        1
+#endif
+
+#ifndef STEPGEN_PIN_INVERT
+/// 1 = pins can be inverted by stepgen_pin_setup()
+#define STEPGEN_PIN_INVERT      1
+#endif
+
+#ifndef STEPGEN_GPIO_BATCH
+/// 1 = collect pin changes of the base thread pass and write every port once
+#define STEPGEN_GPIO_BATCH      1
+#endif
+
+#ifndef STEPGEN_LOOP
+/// 1 = channels can follow the encoder feedback, see stepgen_loop_setup()
+#define STEPGEN_LOOP            ENCODER_MODULE
+#endif
 
 enum
 {
@@ -27,53 +57,196 @@ enum
     STEPGEN_MSG_POS_GET,
     STEPGEN_MSG_POS_SET,
     STEPGEN_MSG_WATCHDOG_SETUP,
+    STEPGEN_MSG_TASK_ADD_BATCH,
+    STEPGEN_MSG_RAMP_ADD,
+    STEPGEN_MSG_STAGE,
+    STEPGEN_MSG_COMMIT,
+    STEPGEN_MSG_DIR_TIMING_SETUP,
+    STEPGEN_MSG_DECEL_SETUP,
+    STEPGEN_MSG_LOOP_SETUP,
+    STEPGEN_MSG_LOOP_STATE_GET,
     STEPGEN_MSG_CNT
 };
 
+/// task types
+enum
+{
+    STEPGEN_TASK_STEP,
+    STEPGEN_TASK_DIR,
+    STEPGEN_TASK_RAMP   // steps with a constant acceleration
+};
+
+/// task type flag: task times are in CPU ticks, not in nanoseconds
+#define STEPGEN_TASK_TICKS      0x80
+/// STEP task type flag: set the DIR pin state before the first step
+#define STEPGEN_TASK_DIR_SET    0x10
+/// STEP task type flag: the DIR pin state for STEPGEN_TASK_DIR_SET (1 = pos--)
+#define STEPGEN_TASK_DIR_VALUE  0x20
+
+#define STEPGEN_DIR_KEEP        0xFF ///< the task doesn't change the DIR pin state
+
+/// stepgen_abort() modes
+enum
+{
+    STEPGEN_ABORT_TASK,     // current task only
+    STEPGEN_ABORT_ALL,      // all tasks added before the abort
+    STEPGEN_ABORT_DECEL     // same as STEPGEN_ABORT_ALL, but ramp down to a stop first
+};
+
+#define STEPGEN_RAMP_K_ONE      (1LL << 40) ///< 1.0 of the RAMP task factor
+
+#define STEPGEN_DIR_TIME_MAX    100000000 ///< max DIR setup and hold time (in nanoseconds)
+#define STEPGEN_DECEL_MAX       (1UL << 24) ///< max abort deceleration (in steps/s^2)
+#define STEPGEN_LOOP_PERIOD_MIN 2000 ///< min step period of the closed loop corrections (in nanoseconds)
+
+
+
+
+#pragma pack(push, 1)
+/// a task of the STEPGEN_MSG_TASK_ADD_BATCH message
+typedef struct
+{
+    uint8_t     c;
+    uint8_t     type;
+    uint32_t    pulses;
+    uint32_t    pin_low_time;
+    uint32_t    pin_high_time;
+
+} stepgen_msg_task_t;
+
+/// maximum number of tasks in the STEPGEN_MSG_TASK_ADD_BATCH message
+#define STEPGEN_MSG_BATCH_CNT   ((MSG_LEN - 1) / sizeof(stepgen_msg_task_t))
+
+/// the STEPGEN_MSG_TASK_ADD_BATCH message data
+typedef struct
+{
+    uint8_t             cnt;
+    stepgen_msg_task_t  tasks[STEPGEN_MSG_BATCH_CNT];
+
+} stepgen_msg_batch_t;
+#pragma pack(pop)
+
 
 
 
+/// a fifo slot
 typedef struct
 {
-    uint8_t     type; // 0:step, 1:dir
-    uint32_t    pulses; // 0:empty slot, !0:used
+    uint32_t    pulses;
     uint32_t    low_ticks;
     uint32_t    high_ticks;
-    uint64_t    tick;
+    uint32_t    ramp_end; // RAMP task end period (in CPU ticks)
+    int64_t     ramp_k; // RAMP task start factor (Q40)
+    uint8_t     type; // STEPGEN_TASK_STEP, STEPGEN_TASK_DIR, STEPGEN_TASK_RAMP
+    uint8_t     dir; // DIR pin state before the task, STEPGEN_DIR_KEEP = no change
+#if STEPGEN_LOOP
+    uint8_t     corr; // 1 = closed loop correction task
+#endif
 
 } stepgen_fifo_slot_t;
 
+/// a channel state, used by every pin toggle
 typedef struct
 {
+    uint32_t    task_tick; // lower 32 bits of CPU ticks
+    int32_t     pos; // in pulses
+
+    uint8_t     fifo_head; // current task, free running index
+    uint8_t     fifo_tail; // next free slot, free running index
     uint8_t     pin_state[2];
-    uint8_t     pin_port[2];
+
+    uint8_t     abort;
+    uint8_t     staged; // 1 = new tasks wait for stepgen_commit()
+    uint8_t     dir_wait; // 1 = the first step of the task waits for the DIR timing
+#if STEPGEN_INFINITE
+    uint8_t     task_infinite;
+#endif
+
+} stepgen_ch_t;
+
+/// a channel task start state, used once per task
+typedef struct
+{
+    uint32_t    dir_tick; // DIR change time OR the earliest time to change DIR
+    uint8_t     dir_state; // inline DIR change state
+    uint8_t     abort_tail; // fifo tail at the abort command
+    uint8_t     decel; // 1 = current task is the abort deceleration
+#if STEPGEN_LOOP
+    uint8_t     host_dir; // DIR pin state of the last host task
+#endif
+
+} stepgen_start_t;
+
+/// a channel pins setup
+typedef struct
+{
     uint32_t    pin_mask[2];
     uint32_t    pin_mask_not[2];
-    uint32_t    pin_invert[2];
+    uint8_t     pin_port[2];
+    uint32_t    dir_setup_ticks; // DIR change to the next step time
+    uint32_t    dir_hold_ticks; // step to the next DIR change time
+    uint32_t    decel; // abort deceleration (in steps/s^2), 0 = instant stop
+    uint32_t    decel_inv; // 1/(2*decel) (Q32 << decel_shift)
+    uint8_t     decel_shift;
+#if STEPGEN_PIN_INVERT
+    uint8_t     pin_invert[2];
+#endif
 
-    int32_t     pos; // in pulses
+} stepgen_pin_t;
 
-    uint8_t     abort;
-    uint64_t    abort_tick;
+/// a channel RAMP task state
+typedef struct
+{
+    int64_t     period; // current RAMP task period (in CPU ticks, Q16)
+    int64_t     k; // current RAMP task factor (Q40)
 
-    uint8_t                 task_infinite;
-    uint8_t                 task_slot;
-    uint64_t                task_tick;
-    stepgen_fifo_slot_t     tasks[STEPGEN_FIFO_SIZE];
+} stepgen_ramp_t;
 
-} stepgen_ch_t;
+/// a channel closed loop state
+typedef struct
+{
+    uint8_t     enabled;
+    uint8_t     fault; // 1 = the max error was reached, the channel was aborted
+    uint8_t     enc; // encoder channel id
+    int32_t     scale; // steps per encoder count (Q16)
+    int32_t     offset; // encoder position to the steps position offset
+    uint32_t    deadband; // max error without corrections (in steps)
+    uint32_t    max_error; // error to abort the channel (in steps), 0 = no limit
+    uint32_t    low_ticks; // correction task pin LOW state duration
+    uint32_t    high_ticks; // correction task pin HIGH state duration
+    int32_t     error; // last error (in steps), commanded - encoder position
+    int32_t     corr; // done correction steps, SG.pos - commanded position
+    int32_t     corr_pos; // SG.pos of the last correction while the channel is busy
+
+} stepgen_loop_t;
 
 
 
 
 void stepgen_module_init();
+#if STEPGEN_LOOP
 void stepgen_module_base_thread();
+#endif
 void stepgen_pin_setup(uint8_t c, uint8_t type, uint8_t port, uint8_t pin, uint8_t invert);
-void stepgen_task_add(uint8_t c, uint8_t type, uint32_t pulses, uint32_t pin_low_time, uint32_t pin_high_time);
+int8_t stepgen_task_add(uint8_t c, uint8_t type, uint32_t pulses, uint32_t pin_low_time, uint32_t pin_high_time);
+uint8_t stepgen_task_add_batch(stepgen_msg_batch_t *batch);
+int8_t stepgen_ramp_add(uint8_t c, uint32_t pulses, uint32_t start_period, uint32_t end_period, uint32_t pin_high_time);
+int8_t stepgen_dir_timing_setup(uint8_t c, uint32_t setup_time, uint32_t hold_time);
+int8_t stepgen_stage(uint8_t c);
+uint8_t stepgen_commit(uint32_t start_delay);
+int8_t stepgen_decel_setup(uint8_t c, uint32_t decel);
 void stepgen_abort(uint8_t c, uint8_t all);
 int32_t stepgen_pos_get(uint8_t c);
+uint8_t stepgen_fifo_fill_get(uint8_t c);
 void stepgen_pos_set(uint8_t c, int32_t pos);
+#if STEPGEN_LOOP
+int8_t stepgen_loop_setup(uint8_t c, uint8_t enc, int32_t scale, uint32_t deadband, uint32_t max_error, uint32_t period);
+void stepgen_loop_disable(uint8_t c);
+uint8_t stepgen_loop_state_get(uint8_t c, int32_t * error, int32_t * corr);
+#endif
+#if STEPGEN_WATCHDOG
 void stepgen_watchdog_setup(uint8_t enable, uint32_t time);
+#endif
 int8_t volatile stepgen_msg_recv(uint8_t type, uint8_t * msg, uint8_t length);
 
 
@@ -17,10 +17,13 @@
 
 // private vars
 
-static uint32_t cnt_curr = 0;
 static uint32_t cnt_prev = 0;
 static uint32_t cnt_ovfl = 0;
 
+#if TIMER_IRQ_MODE
+static timer_irq_func_t irq_callback = 0;
+#endif
+
 
 
 
@@ -71,19 +74,89 @@ uint32_t timer_cnt_get()
 
 /**
  * @brief   get system timer counter total value
+ * @note    safe to call from the main loop and from the tick timer interrupt
  * @retval  0 .. 2^64-1 (ticks)
  */
 uint64_t timer_cnt_get_64()
 {
+    uint32_t cnt_curr, sr = 0;
+    uint64_t cnt;
+
+    // the overflow count must not be updated twice for one wrap,
+    // the lock is nestable, callers can hold TIMER_IRQ_LOCK() already
+    TIMER_IRQ_SAVE(sr);
+
     // get system timer ticks counter value
-    __asm__ __volatile__ ("l.mfspr\t\t%0,%1,0" : "=r" (cnt_curr) : "r" (OR1K_SPR_TICK_TTCR_ADDR));
+    cnt_curr = TIMER_CNT_GET();
 
     if ( cnt_curr < cnt_prev ) ++cnt_ovfl;
 
     cnt_prev = cnt_curr;
 
-    return ((uint64_t)cnt_ovfl) * ((uint64_t)4294967296UL) + ((uint64_t)cnt_curr);
+    cnt = ((uint64_t)cnt_ovfl) * ((uint64_t)4294967296UL) + ((uint64_t)cnt_curr);
+
+    TIMER_IRQ_RESTORE(sr);
+
+    return cnt;
+}
+
+
+
+
+#if TIMER_IRQ_MODE
+/**
+ * @brief   set the function to call from the tick timer interrupt
+ * @param   func    pointer to the callback function
+ * @retval  none
+ */
+void timer_irq_callback_set(timer_irq_func_t func)
+{
+    irq_callback = func;
+}
+
+/**
+ * @brief   request the tick timer interrupt at the selected tick
+ *
+ * @note    deadlines which are too far will be shortened
+ *          to TIMER_IRQ_MAX_TICKS, the callback must call
+ *          this function again anyway
+ *
+ * @param   tick    lower 32 bits of the timer counter to interrupt at
+ *
+ * @retval   0 (interrupt requested)
+ * @retval  -1 (deadline is closer than TIMER_IRQ_MIN_TICKS or passed already)
+ */
+int8_t timer_irq_setup(uint32_t tick)
+{
+    uint32_t now = TIMER_CNT_GET();
+    int32_t delta = (int32_t)(tick - now);
+
+    if ( delta < (int32_t)TIMER_IRQ_MIN_TICKS ) return -1;
+    if ( delta > (int32_t)TIMER_IRQ_MAX_TICKS ) tick = now + TIMER_IRQ_MAX_TICKS;
+
+    // continues mode, interrupt on TTCR[27:0] == TP, pending flag cleared
+    or1k_mtspr(OR1K_SPR_TICK_TTMR_ADDR,
+        OR1K_SPR_TICK_TTMR_MODE_SET(0, OR1K_SPR_TICK_TTMR_MODE_CONTINUE) |
+        OR1K_SPR_TICK_TTMR_IE_MASK |
+        (tick & OR1K_SPR_TICK_TTMR_TP_MASK));
+
+    return 0;
+}
+
+/**
+ * @brief   the tick timer interrupt handler
+ * @note    this function is called from the exception handler only
+ * @retval  none
+ */
+SYS_HOT void timer_irq_handler()
+{
+    // clear pending flag and disable the interrupt
+    TIMER_START();
+
+    // the callback will request a new interrupt
+    if ( irq_callback ) (*irq_callback)();
 }
+#endif
 
 
 
@@ -25,6 +25,23 @@
 #define TIMER_FREQUENCY         CPU_FREQ
 #define TIMER_FREQUENCY_MHZ     (CPU_FREQ/1000000)
 
+/// nanoseconds to ticks multiplier (Q32, rounded up), CPU_FREQ must be below 1 GHz
+#define TIMER_NS_TO_TICKS_MUL \
+    ((uint32_t)((((uint64_t)TIMER_FREQUENCY_MHZ << 32) + 999) / 1000))
+/// nanoseconds to ticks conversion without a division
+#define NS_TO_TICKS(NS) \
+    ((uint32_t)(((uint64_t)(NS) * TIMER_NS_TO_TICKS_MUL) >> 32))
+
+#ifndef TIMER_IRQ_MODE
+/// 1 = channels are processed by the tick timer interrupt, not in the main loop
+#define TIMER_IRQ_MODE          0
+#endif
+
+/// deadlines closer than this (in ticks) are processed without an interrupt
+#define TIMER_IRQ_MIN_TICKS     500
+/// maximum distance (in ticks) for the 28-bit TTMR match value
+#define TIMER_IRQ_MAX_TICKS     (1U << 27)
+
 
 
 
@@ -46,6 +63,39 @@
 #define TIMER_CNT_GET() \
     or1k_mfspr(OR1K_SPR_TICK_TTCR_ADDR)
 
+/// is the 32-bit DEADLINE tick reached at the NOW tick? (deadlines must be closer than 2^31 ticks)
+#define TIMER_TICK_DUE(DEADLINE, NOW) \
+    ( (int32_t)((NOW) - (DEADLINE)) >= 0 )
+
+#if TIMER_IRQ_MODE
+/// disable the tick timer interrupt (begin of the critical section)
+#define TIMER_IRQ_LOCK() \
+    or1k_mtspr(OR1K_SPR_SYS_SR_ADDR, or1k_mfspr(OR1K_SPR_SYS_SR_ADDR) & ~OR1K_SPR_SYS_SR_TEE_MASK)
+
+/// enable the tick timer interrupt (end of the critical section)
+#define TIMER_IRQ_UNLOCK() \
+    or1k_mtspr(OR1K_SPR_SYS_SR_ADDR, or1k_mfspr(OR1K_SPR_SYS_SR_ADDR) | OR1K_SPR_SYS_SR_TEE_MASK)
+
+/// the nestable TIMER_IRQ_LOCK(), saves the interrupt state to the SR variable
+#define TIMER_IRQ_SAVE(SR) \
+    do { (SR) = or1k_mfspr(OR1K_SPR_SYS_SR_ADDR); \
+         or1k_mtspr(OR1K_SPR_SYS_SR_ADDR, (SR) & ~OR1K_SPR_SYS_SR_TEE_MASK); } while (0)
+
+/// the nestable TIMER_IRQ_UNLOCK(), restores the interrupt state saved by TIMER_IRQ_SAVE()
+#define TIMER_IRQ_RESTORE(SR) \
+    or1k_mtspr(OR1K_SPR_SYS_SR_ADDR, (SR))
+#else
+#define TIMER_IRQ_LOCK()
+#define TIMER_IRQ_UNLOCK()
+#define TIMER_IRQ_SAVE(SR)      ((void)(SR))
+#define TIMER_IRQ_RESTORE(SR)   ((void)(SR))
+#endif
+
+
+
+
+typedef void (*timer_irq_func_t)(void);
+
 
 
 
@@ -57,6 +107,12 @@ void timer_cnt_set(uint32_t cnt);
 uint32_t timer_cnt_get();
 uint64_t timer_cnt_get_64();
 
+#if TIMER_IRQ_MODE
+void timer_irq_callback_set(timer_irq_func_t func);
+int8_t timer_irq_setup(uint32_t tick);
+void timer_irq_handler();
+#endif
+
 
 
 
@@ -0,0 +1,467 @@
+/**
+ * @file    mod_wave.c
+ *
+ * @brief   precomputed waveform playback module
+ *
+ * This module expands step/dir segments into a buffer of GPIO port words
+ * on a fixed time grid and plays them back, one port write per grid tick
+ * for all channels of the port
+ */
+
+#include "mod_timer.h"
+#include "mod_gpio.h"
+#include "mod_sched.h"
+#include "mod_wave.h"
+
+
+
+
+// private vars
+
+static struct wave_ch_t ch[WAVE_CH_CNT] SYS_HOT_BSS = {{0}}; // array of channels data
+static struct wave_pin_t pins[WAVE_CH_CNT] = {{0}}; // array of channels pins
+static struct wave_fifo_item_t fifo[WAVE_CH_CNT][WAVE_FIFO_SIZE] = {{{0}}};
+static uint8_t fifo_head[WAVE_CH_CNT] = {0}; // next task to do, free running index
+static uint8_t fifo_tail[WAVE_CH_CNT] = {0}; // next free item, free running index
+static uint8_t ch_cnt = 0; // number of channels with pins
+
+static uint32_t buf[WAVE_BUF_SIZE] = {0}; // precomputed port words (masked)
+static uint16_t buf_head = 0; // next word to play, free running index
+static uint16_t buf_tail = 0; // next word to expand, free running index
+
+static uint8_t port = PA;
+static uint32_t port_mask = 0, port_mask_not = UINT32_MAX; // pins of all channels
+static uint32_t dir_bits = 0; // current DIR pins state
+static uint32_t grid_ticks = 0;
+static uint32_t play_tick = 0; // CPU tick of the next port word
+static uint32_t slips = 0;
+static uint8_t running = 0;
+static uint8_t expanded = 0; // 1 = all tasks are expanded to the buffer
+
+// uses with GPIO module macros
+extern volatile uint32_t * gpio_port_data[GPIO_PORTS_CNT];
+
+
+
+
+// private functions
+
+/// expand one more port word, returns 0 if all tasks are done
+SYS_HOT static uint8_t expand()
+{
+    uint32_t word = 0, phase;
+    uint8_t c, busy = 0;
+
+    for ( c = 0; c < ch_cnt; c++ )
+    {
+        // start the next task at the next grid period after the last step,
+        // so DIR is held for the one grid period and set up for the half of step period
+        if ( !ch[c].steps )
+        {
+            if ( fifo_head[c] == fifo_tail[c] ) continue;
+
+            struct wave_fifo_item_t *item = &fifo[c][fifo_head[c]++ & WAVE_FIFO_MASK];
+
+            ch[c].steps = item->steps;
+            ch[c].inc = item->inc;
+            ch[c].dir = item->dir;
+
+            if ( item->dir )    dir_bits |= pins[c].dir_mask;
+            else                dir_bits &= ~pins[c].dir_mask;
+        }
+
+        busy = 1;
+
+        // the phase overflow is the end of the step
+        phase = ch[c].phase + ch[c].inc;
+        if ( phase < ch[c].phase )
+        {
+            ch[c].pos += ch[c].dir ? -1 : 1;
+            --ch[c].steps;
+        }
+        ch[c].phase = phase;
+
+        if ( phase & 0x80000000 ) word |= pins[c].step_mask;
+    }
+
+    if ( !busy ) return 0;
+
+    buf[buf_tail++ & WAVE_BUF_MASK] = word | dir_bits;
+
+    return 1;
+}
+
+/// expand port words until the buffer is full or the next scheduler deadline is close
+SYS_HOT static void fill()
+{
+    uint8_t more;
+
+    do
+    {
+        // the playback (TIMER_IRQ_MODE) uses the same buffer, one word per lock
+        TIMER_IRQ_LOCK();
+        more = (uint16_t)(buf_tail - buf_head) < WAVE_BUF_SIZE &&
+               (!sched_cnt || (int32_t)(sched_heap[0].tick - TIMER_CNT_GET()) > WAVE_EXPAND_TICKS);
+        if ( more )
+        {
+            more = expand();
+            expanded = more ? 0 : 1;
+        }
+        TIMER_IRQ_UNLOCK();
+    }
+    while ( more );
+}
+
+/*
+ * plays one port word per call, other channels of the scheduler
+ * are processed between the words, only the base thread expands words
+ */
+SYS_HOT static int8_t sched_process(uint8_t c, uint32_t * deadline)
+{
+    uint32_t now = TIMER_CNT_GET();
+
+    if ( !running ) return -1;
+
+    // no words to play? - wait the base thread for a grid period,
+    // the next word will be late and move the grid
+    if ( buf_head == buf_tail )
+    {
+        if ( expanded ) { running = 0; return -1; }
+        *deadline = now + grid_ticks;
+        return 0;
+    }
+
+    // we are late for more than a grid period? - move the grid
+    if ( TIMER_TICK_DUE(play_tick + grid_ticks, now) )
+    {
+        play_tick = now;
+        ++slips;
+    }
+
+    // one write for all channels of the port
+    *gpio_port_data[port] = (*gpio_port_data[port] & port_mask_not) | buf[buf_head++ & WAVE_BUF_MASK];
+    play_tick += grid_ticks;
+
+    *deadline = play_tick;
+    return 0;
+}
+
+
+
+
+// public methods
+
+/**
+ * @brief   module init
+ * @note    call this function only once before sched_module_init()
+ * @retval  none
+ */
+void wave_module_init()
+{
+    uint8_t i = 0;
+
+    // add message handlers
+    for ( i = WAVE_MSG_SETUP; i < WAVE_MSG_CNT; i++ )
+    {
+        msg_recv_callback_add(i, (msg_recv_func_t) wave_msg_recv);
+    }
+
+    // port words are played by the scheduler
+    sched_func_set(SCHED_WAVE, sched_process);
+}
+
+/**
+ * @brief   module base thread
+ * @note    call this function in the main loop
+ * @retval  none
+ */
+SYS_HOT void wave_module_base_thread()
+{
+    if ( !running ) return;
+
+    fill();
+}
+
+
+
+
+/**
+ * @brief   select the port and the grid period of the waveform
+ *
+ * @param   p           GPIO port number
+ * @param   grid_period time between port words (in nanoseconds)
+ *
+ * @note    the max step frequency is the half of the grid frequency,
+ *          all step periods are rounded to the grid periods
+ *
+ * @retval   0 (done)
+ * @retval  -1 (wrong port/period or the waveform is playing)
+ */
+int8_t wave_setup(uint8_t p, uint32_t grid_period)
+{
+    uint8_t c;
+
+    if ( running || p >= GPIO_PORTS_CNT ) return -1;
+    if ( NS_TO_TICKS(grid_period) < WAVE_GRID_MIN_TICKS ) return -1;
+
+    // the pins of the old port are not used anymore
+    if ( p != port )
+    {
+        for ( c = WAVE_CH_CNT; c--; ) pins[c].step_mask = pins[c].dir_mask = 0;
+        port_mask = dir_bits = 0;
+        port_mask_not = UINT32_MAX;
+        ch_cnt = 0;
+    }
+
+    port = p;
+    grid_ticks = NS_TO_TICKS(grid_period);
+
+    return 0;
+}
+
+/**
+ * @brief   setup GPIO pins of the selected channel
+ *
+ * @param   c           channel id
+ * @param   step_pin    step pin number of the waveform port
+ * @param   dir_pin     DIR pin number of the waveform port or WAVE_NO_PIN
+ *
+ * @retval   0 (done)
+ * @retval  -1 (wrong channel id or the waveform is playing)
+ */
+int8_t wave_pin_setup(uint8_t c, uint8_t step_pin, uint8_t dir_pin)
+{
+    if ( running || c >= WAVE_CH_CNT || step_pin >= 32 ) return -1;
+    if ( dir_pin != WAVE_NO_PIN && dir_pin >= 32 ) return -1;
+
+    port_mask &= ~(pins[c].step_mask | pins[c].dir_mask);
+    dir_bits &= ~pins[c].dir_mask;
+
+    gpio_pin_setup_for_output(port, step_pin);
+    pins[c].step_mask = 1U << step_pin;
+    GPIO_PIN_CLEAR(port, ~pins[c].step_mask);
+
+    pins[c].dir_mask = 0;
+    if ( dir_pin != WAVE_NO_PIN )
+    {
+        gpio_pin_setup_for_output(port, dir_pin);
+        pins[c].dir_mask = 1U << dir_pin;
+        GPIO_PIN_CLEAR(port, ~pins[c].dir_mask);
+    }
+
+    port_mask |= pins[c].step_mask | pins[c].dir_mask;
+    port_mask_not = ~port_mask;
+    if ( c >= ch_cnt ) ch_cnt = c + 1;
+
+    return 0;
+}
+
+/**
+ * @brief   add a new task for the selected channel
+ *
+ * @param   c       channel id
+ * @param   dir     0 = DIR pin LOW and pos++, !0 = DIR pin HIGH and pos--
+ * @param   steps   number of steps
+ * @param   period  step period (in nanoseconds), at least 2 grid periods
+ *
+ * @note    the playback starts WAVE_START_TICKS after the first task,
+ *          so tasks of the same messages pass start together.
+ *          Later tasks are expanded up to WAVE_BUF_SIZE grid periods before the pins
+ *
+ * @retval   0 (task added)
+ * @retval  -1 (task not added)
+ */
+int8_t wave_task_add(uint8_t c, uint8_t dir, uint32_t steps, uint32_t period)
+{
+    struct wave_fifo_item_t *item;
+    uint32_t ticks = NS_TO_TICKS(period);
+
+    if ( c >= ch_cnt || !pins[c].step_mask || !steps || !grid_ticks ) return -1;
+    if ( ticks < 2*grid_ticks ) return -1;
+
+    // no free fifo items?
+    if ( (uint8_t)(fifo_tail[c] - fifo_head[c]) >= WAVE_FIFO_SIZE ) return -1;
+
+    item = &fifo[c][fifo_tail[c] & WAVE_FIFO_MASK];
+    item->steps = steps;
+    item->inc = (uint32_t) ( ((uint64_t)grid_ticks << 32) / ticks );
+    item->dir = dir;
+
+    ++fifo_tail[c];
+
+    expanded = 0;
+
+    // start the playback
+    if ( !running )
+    {
+        running = 1;
+        play_tick = TIMER_CNT_GET() + WAVE_START_TICKS;
+        sched_add(SCHED_ID(SCHED_WAVE, 0), play_tick);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief   stop the playback and drop all tasks
+ * @retval  none
+ */
+void wave_abort()
+{
+    uint8_t c;
+
+    if ( running ) sched_remove(SCHED_ID(SCHED_WAVE, 0));
+    running = 0;
+
+    for ( c = WAVE_CH_CNT; c--; )
+    {
+        fifo_head[c] = fifo_tail[c];
+        ch[c].steps = 0;
+        ch[c].phase = 0;
+        GPIO_PIN_CLEAR(port, ~pins[c].step_mask);
+    }
+
+    buf_head = buf_tail;
+}
+
+
+
+
+/**
+ * @brief   get the playback state
+ * @retval  0 (waveform stopped)
+ * @retval  1 (waveform is playing)
+ */
+uint8_t wave_state_get()
+{
+    return running;
+}
+
+/**
+ * @brief   get the number of grid slips (port words that came too late)
+ * @retval  0..UINT32_MAX
+ */
+uint32_t wave_slips_get()
+{
+    return slips;
+}
+
+/**
+ * @brief   get the channel position
+ * @param   c   channel id
+ * @note    the position is up to WAVE_BUF_SIZE grid periods ahead of the pins
+ * @retval  position in steps
+ */
+int32_t wave_pos_get(uint8_t c)
+{
+    return c < WAVE_CH_CNT ? ch[c].pos : 0;
+}
+
+
+
+
+/**
+ * @brief   "message received" callback
+ *
+ * @note    this function will be called automatically
+ *          when a new message will arrive for this module.
+ *
+ * @param   type    user defined message type (0..0xFF)
+ * @param   msg     pointer to the message buffer
+ * @param   length  the length of a message (0 .. MSG_LEN)
+ *
+ * @retval   0 (message read)
+ * @retval  -1 (message not read)
+ */
+int8_t volatile wave_msg_recv(uint8_t type, uint8_t * msg, uint8_t length)
+{
+    u32_10_t *in = (u32_10_t*) msg;
+    u32_10_t *out;
+
+    switch (type)
+    {
+        case WAVE_MSG_SETUP:
+            out = (u32_10_t*) msg_reserve();
+            out->v[0] = (uint32_t) wave_setup(in->v[0], in->v[1]);
+            msg_commit(type, 4);
+            break;
+        case WAVE_MSG_PIN_SETUP:
+            out = (u32_10_t*) msg_reserve();
+            out->v[0] = (uint32_t) wave_pin_setup(in->v[0], in->v[1], in->v[2]);
+            msg_commit(type, 4);
+            break;
+        case WAVE_MSG_TASK_ADD:
+            out = (u32_10_t*) msg_reserve();
+            out->v[0] = (uint32_t) wave_task_add(in->v[0], in->v[1], in->v[2], in->v[3]);
+            msg_commit(type, 4);
+            break;
+        case WAVE_MSG_ABORT:
+            wave_abort();
+            break;
+        case WAVE_MSG_STATE_GET:
+            out = (u32_10_t*) msg_reserve();
+            out->v[0] = wave_state_get();
+            out->v[1] = wave_slips_get();
+            msg_commit(type, 2*4);
+            break;
+        case WAVE_MSG_POS_GET:
+            out = (u32_10_t*) msg_reserve();
+            out->v[0] = (uint32_t) wave_pos_get(in->v[0]);
+            msg_commit(type, 4);
+            break;
+
+        default: return -1;
+    }
+
+#if TIMER_IRQ_MODE
+    // the playback could be started or stopped
+    sched_irq_thread();
+#endif
+
+    return 0;
+}
+
+
+
+
+/**
+    @example mod_wave.c
+
+    <b>Usage example 1</b>: 4 steppers with the step pins PA0..PA3
+                            and the DIR pins PA4..PA7, 1 us grid
+
+    @code
+        #include <stdint.h>
+        #include "mod_gpio.h"
+        #include "mod_sched.h"
+        #include "mod_wave.h"
+
+        int main(void)
+        {
+            uint8_t c;
+
+            // modules init
+            gpio_module_init();
+            wave_module_init();
+            sched_module_init();
+
+            // port words are played every 1000 ns
+            wave_setup(PA, 1000);
+            for ( c = 0; c < 4; c++ ) wave_pin_setup(c, c, c + 4);
+
+            // 100000 steps at 250 kHz for the channel 0,
+            // 50000 steps backwards at 125 kHz for the channel 1
+            wave_task_add(0, 0, 100000, 4000);
+            wave_task_add(1, 1, 50000, 8000);
+
+            // main loop
+            for(;;)
+            {
+                sched_module_base_thread();
+                wave_module_base_thread();
+            }
+
+            return 0;
+        }
+    @endcode
+*/
@@ -0,0 +1,106 @@
+/**
+ * @file    mod_wave.h
+ *
+ * @brief   precomputed waveform playback module header
+ *
+ * This module expands step/dir segments into a buffer of GPIO port words
+ * on a fixed time grid and plays them back, one port write per grid tick
+ * for all channels of the port
+ */
+
+#ifndef _MOD_WAVE_H
+#define _MOD_WAVE_H
+
+#include <stdint.h>
+#include "mod_msg.h"
+#include "mod_timer.h"
+
+
+
+
+#ifndef WAVE_MODULE
+#define WAVE_MODULE         1   ///< 0 = the module isn't used by the firmware
+#endif
+#ifndef WAVE_CH_CNT
+#define WAVE_CH_CNT         8   ///< maximum number of waveform channels
+#endif
+#ifndef WAVE_FIFO_SIZE
+#define WAVE_FIFO_SIZE      16  ///< size of channel's fifo buffer (power of 2, 2..128)
+#endif
+#ifndef WAVE_BUF_SIZE
+#define WAVE_BUF_SIZE       512 ///< number of precomputed port words (power of 2, 2..32768)
+#endif
+#define WAVE_FIFO_MASK      (WAVE_FIFO_SIZE - 1)
+#define WAVE_BUF_MASK       (WAVE_BUF_SIZE - 1)
+
+#define WAVE_EXPAND_TICKS   200 ///< max CPU ticks to expand one port word, the base thread refill stops before the next deadline
+#define WAVE_DISPATCH_TICKS 250 ///< CPU ticks of one word playback: scheduler pop and re-add, port write, GPIO flush, other channels
+/// minimal grid period (1 us), one word playback plus one word expansion by the base thread
+#define WAVE_GRID_MIN_TICKS (WAVE_DISPATCH_TICKS + WAVE_EXPAND_TICKS)
+#define WAVE_START_TICKS    9000 ///< delay between the first task and the first sample (20 us)
+
+#define WAVE_NO_PIN         0xFF ///< wave_pin_setup() value for the channel without DIR pin
+
+
+
+
+/// a channel state, used by every port word expansion
+struct wave_ch_t
+{
+    uint32_t    phase;              // Q32 step phase, the step pin is HIGH at the upper half
+    uint32_t    inc;                // phase increment per grid period
+    uint32_t    steps;              // steps left to do for this task
+    uint8_t     dir;                // 0 = pos++, !0 = pos--
+
+    int32_t     pos;                // position of the expanded port words
+};
+
+/// a channel pin setup
+struct wave_pin_t
+{
+    uint32_t    step_mask;          // step pin mask
+    uint32_t    dir_mask;           // DIR pin mask or 0
+};
+
+struct wave_fifo_item_t
+{
+    uint32_t    steps;
+    uint32_t    inc;
+    uint8_t     dir;
+};
+
+/// messages types
+enum
+{
+    WAVE_MSG_SETUP = 0xA0,
+    WAVE_MSG_PIN_SETUP,
+    WAVE_MSG_TASK_ADD,
+    WAVE_MSG_ABORT,
+    WAVE_MSG_STATE_GET,
+    WAVE_MSG_POS_GET,
+    WAVE_MSG_CNT
+};
+
+
+
+
+// export public methods
+
+void wave_module_init();
+void wave_module_base_thread();
+
+int8_t wave_setup(uint8_t p, uint32_t grid_period);
+int8_t wave_pin_setup(uint8_t c, uint8_t step_pin, uint8_t dir_pin);
+int8_t wave_task_add(uint8_t c, uint8_t dir, uint32_t steps, uint32_t period);
+void wave_abort();
+
+uint8_t wave_state_get();
+uint32_t wave_slips_get();
+int32_t wave_pos_get(uint8_t c);
+
+int8_t volatile wave_msg_recv(uint8_t type, uint8_t * msg, uint8_t length);
+
+
+
+
+#endif
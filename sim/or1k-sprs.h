@@ -0,0 +1,36 @@
+/**
+ * @file    or1k-sprs.h
+ *
+ * @brief   OR1K special purpose registers for the host simulator
+ *
+ * Only the registers used by the firmware modules, same values as in the newlib
+ */
+
+#ifndef _SIM_OR1K_SPRS_H
+#define _SIM_OR1K_SPRS_H
+
+
+
+
+#define OR1K_SPR_SYS_UPR_ADDR               0x0001
+#define OR1K_SPR_SYS_UPR_DCP_MASK           0x00000002
+#define OR1K_SPR_SYS_SR_ADDR                0x0011
+#define OR1K_SPR_SYS_SR_TEE_MASK            0x00000002
+#define OR1K_SPR_SYS_SR_IEE_MASK            0x00000004
+#define OR1K_SPR_SYS_EPCR_ADDR(I)           (0x0020 + (I))
+
+#define OR1K_SPR_TICK_TTMR_ADDR             0x5000
+#define OR1K_SPR_TICK_TTCR_ADDR             0x5001
+#define OR1K_SPR_TICK_TTMR_TP_MASK          0x0fffffff
+#define OR1K_SPR_TICK_TTMR_IP_MASK          0x10000000
+#define OR1K_SPR_TICK_TTMR_IE_MASK          0x20000000
+#define OR1K_SPR_TICK_TTMR_MODE_DISABLE     0
+#define OR1K_SPR_TICK_TTMR_MODE_RESTART     1
+#define OR1K_SPR_TICK_TTMR_MODE_STOP        2
+#define OR1K_SPR_TICK_TTMR_MODE_CONTINUE    3
+#define OR1K_SPR_TICK_TTMR_MODE_SET(X, V)   (((X) & ~0xc0000000) | ((uint32_t)(V) << 30))
+
+
+
+
+#endif
@@ -0,0 +1,23 @@
+/**
+ * @file    or1k-support.h
+ *
+ * @brief   OR1K support functions for the host simulator
+ *
+ * The tick timer counter (TTCR) is a virtual clock of the simulator
+ */
+
+#ifndef _SIM_OR1K_SUPPORT_H
+#define _SIM_OR1K_SUPPORT_H
+
+#include <stdint.h>
+
+
+
+
+uint32_t or1k_mfspr(uint32_t spr);
+void or1k_mtspr(uint32_t spr, uint32_t value);
+
+
+
+
+#endif
@@ -0,0 +1,697 @@
+/**
+ * @file    sim.c
+ *
+ * @brief   host simulator and benchmark of the firmware base threads
+ *
+ * The firmware modules are built for the host as is. The SRAM A2 and
+ * the IO registers are plain memory blocks at the fixed addresses and
+ * the tick timer counter (TTCR) is a virtual clock:
+ *
+ * - by default the host time of the running code is scaled to the AR100 ticks,
+ *   every -k ticks per host nanosecond (the AR100 is ~10 times slower than a PC)
+ * - with the -d option every TTCR read adds a fixed number of ticks,
+ *   the run is fully repeatable then
+ *
+ * Usage:
+ *
+ *      arisc-sim [options] FILE    replay the command stream from FILE
+ *      arisc-sim [options] -b      find max step rate for 1..STEPGEN_CH_CNT channels
+ *
+ * The command stream is a text file, one ARM message per line:
+ *
+ *      <time in us> <message type> [32-bit words of the message data ...]
+ *
+ * numbers can be decimal or hex (0x..), `#` starts a comment,
+ * words are written in the host byte order
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "../io.h"
+#include "../mod_timer.h"
+#include "../mod_gpio.h"
+#include "../mod_msg.h"
+#include "../mod_sched.h"
+#include "../mod_stepgen.h"
+#include "../mod_pulsgen.h"
+#include "../mod_wave.h"
+#include "../mod_encoder.h"
+#include "../mod_capture.h"
+#include "../mod_status.h"
+#include "../mod_conf.h"
+#include "../mod_perf.h"
+
+#if !SIM || !PERF
+#error "use `make sim` to build the simulator"
+#endif
+#if TIMER_IRQ_MODE
+#error "TIMER_IRQ_MODE isn't supported by the simulator"
+#endif
+
+
+
+
+#define IO_ADDR             0x01c00000 ///< all IO blocks used by the firmware
+#define IO_SIZE             0x00400000
+
+#define HOST_DELTA_MAX      10000 ///< longer host time between clock reads is a host preemption (in ns)
+
+#define TRIAL_TIME          10000000 ///< benchmark trial time (in nanoseconds)
+#define TRIAL_PERIOD_MIN    20 ///< shortest step period to check (in CPU ticks)
+#define TRIAL_PERIOD_MAX    (CPU_FREQ / 1000) ///< longest step period to check (in CPU ticks)
+#define TRIAL_START_DELAY   9000 ///< stepgen_task_add() delay before the first step (in CPU ticks)
+
+
+
+
+/// benchmark trial result
+struct trial_t
+{
+    uint32_t    lateness; // worst pulse lateness (in CPU ticks)
+    uint32_t    late; // number of pulses later than the limit
+    uint32_t    pulses; // number of measured pulses
+    uint64_t    steps; // steps made by all channels
+    struct perf_thread_t loop;
+};
+
+/// a command of the stream
+struct cmd_t
+{
+    uint64_t    time; // in CPU ticks
+    uint8_t     type;
+    uint8_t     length;
+    uint32_t    v[MSG_LEN / 4];
+};
+
+
+
+
+// private vars
+
+static uint32_t ttmr = 0, sr = 0;
+
+static uint32_t ttcr_step = 0; // 0 = scaled host time
+static double ticks_per_ns = 4.5;
+static uint64_t host_last = 0; // host time of the last clock update
+static uint64_t read_cost = 0; // host time of one clock read
+static double ttcr_frac = 0;
+static uint32_t ttcr = 0;
+static uint8_t paused = 0;
+
+static uint8_t verbose = 0;
+static uint32_t lateness_limit = 0; // 0 = a quarter of the step period
+static uint32_t repeat = 3;
+
+static struct msg_t * msg_arm[MSG_MAX_CNT];
+static struct msg_t * msg_arisc[MSG_MAX_CNT];
+#if MSG_RING
+static volatile struct msg_ring_ctrl_t * ring = (struct msg_ring_ctrl_t *) MSG_RING_CTRL_ADDR;
+#endif
+
+
+
+
+// virtual clock
+
+static uint64_t host_ns()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    return *(const uint64_t*)a < *(const uint64_t*)b ? -1 : *(const uint64_t*)a > *(const uint64_t*)b;
+}
+
+/// the median host time between two clock reads is the read cost
+static void clock_calibrate()
+{
+    static uint64_t d[10001];
+    uint64_t t0 = host_ns(), t1, i;
+
+    for ( i = 0; i < 10001; i++, t0 = t1 )
+    {
+        t1 = host_ns();
+        d[i] = t1 - t0;
+    }
+
+    qsort(d, 10001, sizeof(d[0]), cmp_u64);
+    read_cost = d[5000];
+}
+
+static uint32_t clock_update(uint8_t count_read)
+{
+    uint64_t now, delta;
+
+    if ( paused ) return ttcr;
+    if ( ttcr_step ) return count_read ? (ttcr += ttcr_step) : ttcr;
+
+    now = host_ns();
+    delta = now - host_last;
+    host_last = now;
+    if ( delta > HOST_DELTA_MAX ) delta = read_cost;
+
+    // the clock reads themselves aren't the firmware time
+    ttcr_frac += delta > read_cost ? (delta - read_cost) * ticks_per_ns : 0;
+
+    // every read takes a tick at least
+    if ( count_read && ttcr_frac < 1 ) ttcr_frac = 1;
+
+    ttcr += (uint32_t) ttcr_frac;
+    ttcr_frac -= (uint32_t) ttcr_frac;
+
+    return ttcr;
+}
+
+/// stop the virtual clock while the simulator does its own work
+static void clock_pause()
+{
+    clock_update(0);
+    paused = 1;
+}
+
+static void clock_resume()
+{
+    host_last = host_ns();
+    paused = 0;
+}
+
+uint32_t or1k_mfspr(uint32_t spr)
+{
+    switch (spr)
+    {
+        case OR1K_SPR_TICK_TTCR_ADDR: return clock_update(1);
+        case OR1K_SPR_TICK_TTMR_ADDR: return ttmr;
+        case OR1K_SPR_SYS_SR_ADDR: return sr;
+    }
+
+    return 0;
+}
+
+void or1k_mtspr(uint32_t spr, uint32_t value)
+{
+    switch (spr)
+    {
+        case OR1K_SPR_TICK_TTCR_ADDR: ttcr = value; break;
+        case OR1K_SPR_TICK_TTMR_ADDR: ttmr = value; break;
+        case OR1K_SPR_SYS_SR_ADDR: sr = value; break;
+    }
+}
+
+/// the firmware restart (sys.c) isn't simulated
+void reset(void)
+{
+    fprintf(stderr, "firmware reset\n");
+    exit(2);
+}
+
+
+
+
+// firmware
+
+static void map(uintptr_t addr, size_t size)
+{
+    void *p = mmap((void*)addr, size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+
+    if ( p != (void*)addr )
+    {
+        fprintf(stderr, "can't map 0x%08lx..0x%08lx\n", (unsigned long)addr, (unsigned long)(addr + size));
+        exit(1);
+    }
+}
+
+static void firmware_init()
+{
+    uint8_t m;
+
+    map(SRAM_A2_ADDR, SRAM_A2_SIZE);
+    map(IO_ADDR, IO_SIZE);
+
+    for ( m = 0; m < MSG_MAX_CNT; ++m )
+    {
+        msg_arisc[m] = (struct msg_t *) (MSG_ARISC_BLOCK_ADDR + m * MSG_MAX_LEN);
+        msg_arm[m]   = (struct msg_t *) (MSG_ARM_BLOCK_ADDR   + m * MSG_MAX_LEN);
+    }
+
+    host_last = host_ns();
+
+    // same order as in the main()
+    perf_module_init();
+    msg_module_init();
+    gpio_module_init();
+    stepgen_module_init();
+#if PULSGEN_MODULE
+    pulsgen_module_init();
+#endif
+#if WAVE_MODULE
+    wave_module_init();
+#endif
+#if ENCODER_MODULE
+    encoder_module_init();
+#endif
+#if CAPTURE_MODULE
+    capture_module_init();
+#endif
+#if STATUS_MODULE
+    status_module_init();
+#endif
+    sched_module_init();
+#if CONF_MODULE
+    conf_module_init();
+#endif
+}
+
+/// one pass of the main loop, same as in the main()
+static void firmware_pass()
+{
+    PERF_LOOP();
+    PERF_CALL(PERF_THREAD_MSG, msg_module_base_thread());
+#if ENCODER_MODULE
+    PERF_CALL(PERF_THREAD_ENCODER, encoder_module_base_thread());
+#endif
+#if STEPGEN_LOOP
+    PERF_CALL(PERF_THREAD_STEPGEN, stepgen_module_base_thread());
+#endif
+#if CAPTURE_MODULE
+    PERF_CALL(PERF_THREAD_CAPTURE, capture_module_base_thread());
+#endif
+    PERF_CALL(PERF_THREAD_SCHED, sched_module_base_thread());
+#if WAVE_MODULE
+    PERF_CALL(PERF_THREAD_WAVE, wave_module_base_thread());
+#endif
+#if STATUS_MODULE
+    PERF_CALL(PERF_THREAD_STATUS, status_module_base_thread());
+#endif
+#if CONF_MODULE
+    PERF_CALL(PERF_THREAD_CONF, conf_module_base_thread());
+#endif
+}
+
+
+
+
+// ARM side of the mailbox
+
+static int8_t arm_send(struct cmd_t *cmd)
+{
+    uint8_t m;
+
+#if MSG_RING
+    uint32_t tail = ring->arm_tail;
+
+    if ( (tail - ring->arm_head) >= MSG_MAX_CNT ) return -1;
+    m = tail & (MSG_MAX_CNT - 1);
+#else
+    static uint8_t last = MSG_MAX_CNT - 1;
+    uint8_t i;
+
+    // the ARM uses slots one by one, same as msg_send()
+    for ( i = MSG_MAX_CNT, m = last; i--; )
+    {
+        if ( ++m >= MSG_MAX_CNT ) m = 0;
+        if ( !msg_arm[m]->unread ) break;
+    }
+    if ( msg_arm[m]->unread ) return -1;
+    last = m;
+#endif
+
+    memcpy(msg_arm[m]->msg, cmd->v, cmd->length);
+    msg_arm[m]->type = cmd->type;
+    msg_arm[m]->length = cmd->length;
+
+#if MSG_RING
+    msg_arm[m]->unread = (uint8_t)tail;
+    msync();
+    ring->arm_tail = tail + 1;
+#else
+    msync();
+    msg_arm[m]->unread = 1;
+#endif
+
+    return 0;
+}
+
+static void arm_print(struct msg_t *msg, uint32_t now)
+{
+    uint32_t i, w;
+
+    printf("%10.3f reply 0x%02x", (double)now * 1000000 / CPU_FREQ, msg->type);
+    for ( i = 0; i < msg->length; i += 4 )
+    {
+        memcpy(&w, &msg->msg[i], 4);
+        printf(" 0x%08x", w);
+    }
+    printf("\n");
+}
+
+static void arm_recv(uint32_t now)
+{
+#if MSG_RING
+    uint32_t head = ring->arisc_head;
+
+    for ( ; head != ring->arisc_tail; head++ )
+    {
+        if ( verbose ) arm_print(msg_arisc[head & (MSG_MAX_CNT - 1)], now);
+    }
+
+    ring->arisc_head = head;
+#else
+    uint8_t m;
+
+    for ( m = 0; m < MSG_MAX_CNT; m++ )
+    {
+        if ( !msg_arisc[m]->unread ) continue;
+        if ( verbose ) arm_print(msg_arisc[m], now);
+        msg_arisc[m]->unread = 0;
+    }
+#endif
+}
+
+
+
+
+// reports
+
+static void report_thread(const char *name, uint8_t thread)
+{
+    struct perf_thread_t t;
+
+    perf_thread_get(thread, &t);
+    if ( !t.cnt ) return;
+
+    printf("  %-8s  %10u  %10u  %10u  %12u\n", name, t.min, t.avg, t.max, t.cnt);
+}
+
+static void report()
+{
+    uint8_t c;
+
+    printf("\nthread time per pass (CPU ticks):\n");
+    printf("  %-8s  %10s  %10s  %10s  %12s\n", "thread", "min", "avg", "max", "passes");
+    report_thread("loop", PERF_THREAD_LOOP);
+    report_thread("msg", PERF_THREAD_MSG);
+    report_thread("encoder", PERF_THREAD_ENCODER);
+    report_thread("sched", PERF_THREAD_SCHED);
+    report_thread("status", PERF_THREAD_STATUS);
+    report_thread("wave", PERF_THREAD_WAVE);
+    report_thread("capture", PERF_THREAD_CAPTURE);
+    report_thread("stepgen", PERF_THREAD_STEPGEN);
+    report_thread("conf", PERF_THREAD_CONF);
+
+    printf("\nstepgen channels:\n");
+    printf("  %-8s  %12s  %16s\n", "channel", "position", "max lateness");
+    for ( c = 0; c < STEPGEN_CH_CNT; c++ )
+    {
+        if ( !perf_lateness_max_get(c) && !stepgen_pos_get(c) ) continue;
+        printf("  %-8u  %12d  %10u ticks\n", c, stepgen_pos_get(c), perf_lateness_max_get(c));
+    }
+}
+
+
+
+
+// command stream replay
+
+static uint32_t stream_load(const char *path, struct cmd_t **list)
+{
+    FILE *f = fopen(path, "r");
+    char line[1024], *p, *end;
+    uint32_t cnt = 0, size = 0;
+    struct cmd_t cmd;
+    double us;
+
+    if ( !f ) { perror(path); exit(1); }
+
+    *list = 0;
+
+    while ( fgets(line, sizeof(line), f) )
+    {
+        if ( (p = strchr(line, '#')) ) *p = 0;
+
+        us = strtod(line, &end);
+        if ( end == line ) continue;
+
+        memset(&cmd, 0, sizeof(cmd));
+        cmd.time = (uint64_t)(us * (CPU_FREQ / 1000000));
+        p = end;
+        cmd.type = (uint8_t) strtoul(p, &end, 0);
+        if ( end == p ) { fprintf(stderr, "%s: no message type: %s", path, line); exit(1); }
+
+        for ( p = end; cmd.length < MSG_LEN; p = end )
+        {
+            cmd.v[cmd.length / 4] = (uint32_t) strtoul(p, &end, 0);
+            if ( end == p ) break;
+            cmd.length += 4;
+        }
+
+        if ( cnt >= size )
+        {
+            size = size ? size * 2 : 256;
+            *list = realloc(*list, size * sizeof(struct cmd_t));
+        }
+        (*list)[cnt++] = cmd;
+    }
+
+    fclose(f);
+
+    return cnt;
+}
+
+static void replay(const char *path, uint32_t tail_time)
+{
+    struct cmd_t *list;
+    uint32_t cnt = stream_load(path, &list), i = 0;
+    uint32_t start, now, prev;
+    uint64_t elapsed = 0, end;
+
+    firmware_init();
+
+    end = cnt ? list[cnt - 1].time : 0;
+    end += NS_TO_TICKS(tail_time);
+
+    clock_pause();
+    start = prev = timer_cnt_get();
+    clock_resume();
+
+    while ( elapsed < end )
+    {
+        firmware_pass();
+
+        clock_pause();
+        now = timer_cnt_get();
+        elapsed += now - prev;
+        prev = now;
+
+        // send all commands which time is come
+        for ( ; i < cnt && list[i].time <= elapsed; i++ )
+        {
+            if ( arm_send(&list[i]) ) break; // mailbox is full, try on the next pass
+        }
+
+        arm_recv(now - start);
+        clock_resume();
+    }
+
+    printf("%u commands, %.3f ms\n", i, (double)elapsed * 1000 / CPU_FREQ);
+    report();
+
+    free(list);
+}
+
+
+
+
+// benchmark
+
+static void trial_run(uint8_t n, uint32_t period, uint32_t limit, struct trial_t *r)
+{
+    uint32_t start, high = period / 2;
+    const uint16_t *hist;
+    uint8_t c, b;
+
+    firmware_init();
+
+    // STEP pins: 16 channels per port
+    for ( c = 0; c < n; c++ ) stepgen_pin_setup(c, 0, c >> 4, c & 15, 0);
+
+    for ( c = 0; c < n; c++ )
+    {
+        stepgen_task_add(c, STEPGEN_TASK_STEP | STEPGEN_TASK_TICKS, INT32_MAX, period - high, high);
+    }
+
+    perf_reset();
+
+    clock_pause();
+    start = timer_cnt_get();
+    clock_resume();
+
+    while ( (uint32_t)(ttcr - start) < NS_TO_TICKS(TRIAL_TIME) ) firmware_pass();
+
+    clock_pause();
+    memset(r, 0, sizeof(*r));
+    for ( c = 0; c < n; c++ )
+    {
+        if ( perf_lateness_max_get(c) > r->lateness ) r->lateness = perf_lateness_max_get(c);
+        r->steps += (uint32_t) stepgen_pos_get(c);
+
+        // bucket b > 0 holds the lateness from 2^(b-1) ticks
+        hist = perf_hist_get(c);
+        for ( b = 0; b < PERF_HIST_CNT; b++ )
+        {
+            r->pulses += hist[b];
+            if ( b && (1U << (b - 1)) > limit ) r->late += hist[b];
+        }
+    }
+    perf_thread_get(PERF_THREAD_LOOP, &r->loop);
+}
+
+/// every trial is a new process with the clean firmware state
+static int8_t trial(uint8_t n, uint32_t period, uint32_t limit, struct trial_t *r)
+{
+    int fd[2], status;
+    pid_t pid;
+
+    if ( pipe(fd) ) { perror("pipe"); exit(1); }
+
+    pid = fork();
+    if ( pid < 0 ) { perror("fork"); exit(1); }
+
+    if ( !pid )
+    {
+        close(fd[0]);
+        trial_run(n, period, limit, r);
+        if ( write(fd[1], r, sizeof(*r)) != sizeof(*r) ) _exit(1);
+        _exit(0);
+    }
+
+    close(fd[1]);
+    status = read(fd[0], r, sizeof(*r)) == sizeof(*r) ? 0 : -1;
+    close(fd[0]);
+    waitpid(pid, 0, 0);
+
+    return status;
+}
+
+/**
+ * the step rate is sustainable if one of `repeat` trials is fine,
+ * with the host time 0.1% of late pulses are allowed for the host interrupts
+ */
+static uint8_t sustainable(uint8_t n, uint32_t period, struct trial_t *r)
+{
+    uint32_t limit = lateness_limit ? lateness_limit : period / 4;
+    uint64_t expected = (uint64_t) n * (NS_TO_TICKS(TRIAL_TIME) - TRIAL_START_DELAY) / period;
+    uint32_t i;
+
+    for ( i = 0; i < repeat; i++ )
+    {
+        if ( trial(n, period, limit, r) ) continue;
+
+        // no steps are lost?
+        if ( (r->steps + n) < expected ) continue;
+
+        // edges are on time? the repeatable clock must be exact
+        if ( ttcr_step ? r->lateness <= limit : r->late <= r->pulses / 1000 ) return 1;
+    }
+
+    return 0;
+}
+
+
+
+
+static void benchmark()
+{
+    uint32_t lo, hi, mid;
+    struct trial_t r, found;
+    uint8_t n;
+
+    printf("%-8s  %12s  %12s  %12s  %12s\n", "channels", "max rate Hz", "lateness", "loop avg", "loop max");
+
+    // 1, 2, 4 .. STEPGEN_CH_CNT channels
+    for ( n = 1; n; n = n == STEPGEN_CH_CNT ? 0 : (n * 2 < STEPGEN_CH_CNT ? n * 2 : STEPGEN_CH_CNT) )
+    {
+        lo = TRIAL_PERIOD_MIN;
+        hi = TRIAL_PERIOD_MAX;
+
+        if ( !sustainable(n, hi, &found) )
+        {
+            printf("%-8u  %12s\n", n, "< 1000");
+            continue;
+        }
+
+        // the shortest sustainable step period
+        while ( lo + 1 < hi )
+        {
+            mid = lo + (hi - lo) / 2;
+            if ( sustainable(n, mid, &r) ) { hi = mid; found = r; }
+            else lo = mid;
+        }
+
+        printf("%-8u  %12u  %12u  %12u  %12u\n", n, CPU_FREQ / hi, found.lateness, found.loop.avg, found.loop.max);
+        fflush(stdout);
+    }
+}
+
+
+
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+        "usage: %s [options] FILE   replay the command stream\n"
+        "       %s [options] -b     find max step rate per channels count\n"
+        "options:\n"
+        "  -k TICKS   CPU ticks per host nanosecond (default %.1f)\n"
+        "  -d TICKS   add TICKS at every timer read instead of the host time\n"
+        "  -t US      run time after the last command (default 1000 us)\n"
+        "  -l TICKS   max allowed pulse lateness (default period/4)\n"
+        "  -r N       trials per step rate, the best one is used (default %u)\n"
+        "  -v         print ARISC replies\n",
+        name, name, ticks_per_ns, repeat);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t tail_time = 1000000;
+    uint8_t bench = 0;
+    int opt;
+
+    while ( (opt = getopt(argc, argv, "k:d:t:l:r:vb")) != -1 )
+    {
+        switch (opt)
+        {
+            case 'k': ticks_per_ns = strtod(optarg, 0); break;
+            case 'd': ttcr_step = strtoul(optarg, 0, 0); break;
+            case 't': tail_time = strtoul(optarg, 0, 0) * 1000; break;
+            case 'l': lateness_limit = strtoul(optarg, 0, 0); break;
+            case 'r': repeat = strtoul(optarg, 0, 0); break;
+            case 'v': verbose = 1; break;
+            case 'b': bench = 1; break;
+            default: usage(argv[0]);
+        }
+    }
+
+    if ( ticks_per_ns <= 0 || !repeat ) usage(argv[0]);
+
+    clock_calibrate();
+
+    // the virtual clock is repeatable
+    if ( ttcr_step ) repeat = 1;
+
+    if ( bench ) benchmark();
+    else if ( optind < argc ) replay(argv[optind], tail_time);
+    else usage(argv[0]);
+
+    return 0;
+}
@@ -2,6 +2,8 @@
 #include <or1k-sprs.h>
 #include "io.h"
 #include "sys.h"
+#include "mod_timer.h"
+#include "mod_conf.h"
 
 
 
@@ -14,6 +16,19 @@ void enable_caches(void)
 	}
 
 	or1k_icache_enable();
+
+#if SYS_DCACHE
+	// data cache is present?
+	if ( or1k_mfspr(OR1K_SPR_SYS_UPR_ADDR) & OR1K_SPR_SYS_UPR_DCP_MASK )
+	{
+		for (unsigned addr = 0; addr < 16 * 1024 + 32 * 1024; addr += 16)
+		{
+			or1k_dcache_flush(addr);
+		}
+
+		or1k_dcache_enable();
+	}
+#endif
 }
 
 
@@ -27,6 +42,16 @@ void reset(void)
 
 void handle_exception(uint32_t type, uint32_t pc, uint32_t sp)
 {
+#if TIMER_IRQ_MODE
+    // tick timer interrupt?
+    if ( type == 5 ) { timer_irq_handler(); return; }
+#endif
+
+#if CONF_MODULE
+    // positions will be restored by the next conf_module_init()
+    conf_warm_save(type, pc);
+#endif
+
     reset();
 }
 
@@ -8,6 +8,36 @@
 
 #define CPU_FREQ 450000000 // Hz
 
+#ifndef SYS_DCACHE
+/// 1 = enable the data cache if the CPU has it,
+/// the ARM <-> ARISC shared memory isn't coherent then (no MMU to make it uncached),
+/// so this is for the standalone test builds only
+#define SYS_DCACHE 0
+#endif
+
+#ifndef SYS_HOT_SECTIONS
+/// 1 = place the hot code and data into the cache line aligned sections
+/// grouped together by arisc-fw.ld
+#define SYS_HOT_SECTIONS 1
+#endif
+#define SYS_CACHE_LINE 16 // bytes, same for the icache and dcache
+
+#if SYS_HOT_SECTIONS
+/// function of the main loop or channels processing
+#define SYS_HOT         __attribute__((section(".text.hot"), aligned(SYS_CACHE_LINE)))
+/// initialized data used by every channels processing pass
+#define SYS_HOT_DATA    __attribute__((section(".data.hot"), aligned(SYS_CACHE_LINE)))
+/// zero initialized data used by every channels processing pass
+#define SYS_HOT_BSS     __attribute__((section(".bss.hot"), aligned(SYS_CACHE_LINE)))
+#else
+#define SYS_HOT
+#define SYS_HOT_DATA
+#define SYS_HOT_BSS
+#endif
+
+/// data kept by the reset, the bss clear at the start doesn't touch it
+#define SYS_NOINIT      __attribute__((section(".noinit")))
+
 
 
 